@@ -6,18 +6,33 @@
 #include "framework.h"
 #include "pch.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <list>
+#include <map>
+#include <string>
 #include <math.h>
 #include <memory>
+#include <mutex>
+#include <regex>
 #include <stdbool.h>
 #include <stdio.h>
 #include <tchar.h>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
+#include <d3d11.h>
+#include <shellapi.h>
 #include <winstring.h>
+#include <wrl/client.h>
 
 #include "wil/filesystem.h"
 #include "wil/stl.h"
@@ -30,7 +45,15 @@
 
 extern "C" {
 #include "libavcodec/avcodec.h"
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+#include "libavfilter/buffersrc.h"
 #include "libavformat/avformat.h"
+#include "libavutil/channel_layout.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/md5.h"
+#include "libavutil/opt.h"
+#include "libavutil/time.h"
 #include "libswresample/swresample.h"
 #include "libswscale/swscale.h"
 }
@@ -56,23 +79,344 @@ std::string SysWideToMultiByte(const std::wstring &wide, uint32_t code_page) {
   return mb;
 }
 
+std::wstring SysMultiByteToWide(const std::string &mb, uint32_t code_page) {
+  int mb_length = static_cast<int>(mb.length());
+  if (mb_length == 0)
+    return std::wstring();
+
+  int charcount =
+      MultiByteToWideChar(code_page, 0, mb.data(), mb_length, NULL, 0);
+  if (charcount == 0)
+    return std::wstring();
+
+  std::wstring wide;
+  wide.resize(static_cast<size_t>(charcount));
+  MultiByteToWideChar(code_page, 0, mb.data(), mb_length, &wide[0],
+                      charcount);
+
+  return wide;
+}
+
+// 命令行参数，例如：FFPlayer.exe --vf "yadif,scale=1280:-2"
+struct Options {
+  std::string videoFilter;          // 解码与上传之间的 libavfilter 滤镜描述
+  std::string recordPath;           // 启动即录制渲染输出到该文件（F9 切换）
+  std::string recordCodec = "h264"; // 录制编码器：h264 或 ffv1
+  std::string tracePath;            // Chrome trace 输出文件，F12 或退出时写出
+  std::string input;                // 输入：文件、-（stdin）、命名管道、tcp/udp
+  std::string audioTrack;           // 音轨：序号（从 0 起）、语言或 none
+  std::string subtitleTrack;        // 字幕轨：序号（从 0 起）、语言或 none
+  bool live = false;                // 直播低延迟模式
+  double latencyTarget = 0.15;      // 直播目标延迟（秒），--latency 以毫秒指定
+  bool wallclockPts = false;        // 源端 pts 为采集时的墙上时间，测端到端延迟
+  std::string exportName;           // 呈现的帧导出到该名字的共享内存
+  uint32_t exportSlots = 4;         // 共享内存槽位数
+  std::string consumeName;          // 作为参考读者运行，读取导出的帧
+  std::string benchmarkPath;        // 运行基准测试并写出结果 JSON
+  std::string baselinePath;         // 基准测试基线（此前的结果文件）
+  double benchmarkTolerance = 0.25; // 允许比基线慢的比例，--tolerance 以%指定
+  std::string verifyPath;           // 逐帧校验并写出校验报告
+  std::string referencePath;        // 校验参考报告，与本次结果逐行比较
+};
+
+Options gOptions;
+
+Options ParseCommandLine(LPCWSTR commandLine) {
+  Options options;
+  int argc = 0;
+  auto argv = CommandLineToArgvW(commandLine, &argc);
+  if (!argv)
+    return options;
+
+  std::vector<std::string> arguments;
+  for (int i = 0; i < argc; ++i) {
+    arguments.push_back(SysWideToMultiByte(argv[i], CP_UTF8));
+  }
+  LocalFree(argv);
+
+  for (std::size_t i = 0; i < arguments.size(); ++i) {
+    const auto &argument = arguments[i];
+    auto hasValue = i + 1 < arguments.size();
+    if (argument == "--vf" && hasValue) {
+      options.videoFilter = arguments[++i];
+    } else if (argument == "--record" && hasValue) {
+      options.recordPath = arguments[++i];
+    } else if (argument == "--record-codec" && hasValue) {
+      options.recordCodec = arguments[++i];
+    } else if (argument == "--trace" && hasValue) {
+      options.tracePath = arguments[++i];
+    } else if (argument == "--input" && hasValue) {
+      options.input = arguments[++i];
+    } else if (argument == "--audio-track" && hasValue) {
+      options.audioTrack = arguments[++i];
+    } else if (argument == "--subtitle-track" && hasValue) {
+      options.subtitleTrack = arguments[++i];
+    } else if (argument == "--live") {
+      options.live = true;
+    } else if (argument == "--latency" && hasValue) {
+      options.latencyTarget = std::atof(arguments[++i].c_str()) / 1000.0;
+    } else if (argument == "--wallclock-pts") {
+      options.wallclockPts = true;
+    } else if (argument == "--export" && hasValue) {
+      options.exportName = arguments[++i];
+    } else if (argument == "--export-slots" && hasValue) {
+      options.exportSlots =
+          static_cast<uint32_t>(std::atoi(arguments[++i].c_str()));
+    } else if (argument == "--consume" && hasValue) {
+      options.consumeName = arguments[++i];
+    } else if (argument == "--benchmark") {
+      options.benchmarkPath =
+          hasValue && arguments[i + 1].rfind("--", 0) != 0 ? arguments[++i]
+                                                           : "benchmark.json";
+    } else if (argument == "--baseline" && hasValue) {
+      options.baselinePath = arguments[++i];
+    } else if (argument == "--tolerance" && hasValue) {
+      options.benchmarkTolerance = std::atof(arguments[++i].c_str()) / 100.0;
+    } else if (argument == "--verify") {
+      options.verifyPath =
+          hasValue && arguments[i + 1].rfind("--", 0) != 0 ? arguments[++i]
+                                                           : "verify.txt";
+    } else if (argument == "--reference" && hasValue) {
+      options.referencePath = arguments[++i];
+    }
+  }
+  return options;
+}
+
 } // namespace
 
 namespace Foundation {
 
+// 启动时刻，用于统计首帧耗时。
+Uint64 gStartupCounter = 0;
+
+// 字体文件位于程序目录。FreeType 的 FT_Library 不是线程安全的，
+// 字体的打开和关闭在此串行化，已打开的字体可由单个线程独占使用。
+std::mutex gFontMutex;
+
+TTF_Font *OpenFont(int pointSize) {
+  std::filesystem::path path(wil::GetModuleFileNameW<std::wstring>(nullptr));
+  path = path.parent_path().append("msyh.ttf");
+  if (!std::filesystem::exists(path))
+    return nullptr;
+
+  auto multi_byte_path = SysWideToMultiByte(path.c_str(), CP_ACP);
+  std::lock_guard<std::mutex> lock(gFontMutex);
+  return TTF_OpenFont(multi_byte_path.c_str(), pointSize);
+}
+
+void CloseFont(TTF_Font *font) {
+  if (!font)
+    return;
+  std::lock_guard<std::mutex> lock(gFontMutex);
+  TTF_CloseFont(font);
+}
+
+namespace Trace {
+void SetThreadName(const char *name);
+} // namespace Trace
+
+// 任务调度器
+// 每个工作线程按优先级各有一个双端队列：本线程从尾部取（后进先出，缓存友好），
+// 空闲线程从其他线程的头部窃取。取任务时先扫描所有线程的实时队列，再看解码
+// 队列，最后才是后台队列，媒体打开和帧哈希不会排在字体加载、帧导出之后。
+// 提交和取任务只改原子计数，只有工作线程睡眠和唤醒时才锁 idleMutex。
+// 析构时不再接受新任务，已排队的任务全部执行完后工作线程退出，future 不会悬空。
+class Scheduler {
+public:
+  enum Priority {
+    // 留给有截止时间的短任务。音频目前在 SDL 回调线程里直接解码混音，回调
+    // 必须同步返回数据，交给线程池只会多一次排队，所以暂时没有任务使用它。
+    RealTime,
+    Decode,     // 媒体打开、解码预热、帧哈希
+    Background, // 字体加载、导出、探测等
+    PriorityCount,
+  };
+
+  explicit Scheduler(unsigned int workerCount) {
+    workerCount = (std::max)(workerCount, 1u);
+    for (unsigned int i = 0; i < workerCount; ++i)
+      workers.push_back(std::make_unique<Worker>());
+    for (std::size_t i = 0; i < workers.size(); ++i)
+      workers[i]->thread = std::thread(&Scheduler::Run, this, i);
+  }
+  ~Scheduler() {
+    {
+      std::lock_guard<std::mutex> lock(idleMutex);
+      stopping = true;
+    }
+    idle.notify_all();
+    for (auto &worker : workers)
+      worker->thread.join();
+  }
+
+  Scheduler(const Scheduler &) = delete;
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  // 工作线程内提交的任务进入本线程队列，其他线程提交的任务轮流分给各工作线程。
+  void Post(Priority priority, std::function<void()> task) {
+    // 先计数再检查 stopping：析构一旦开始，工作线程看到 pending 不为 0 就不会
+    // 退出，这个任务不会丢。
+    ++pending;
+    // 关闭过程中提交的任务就地执行，任务可以继续提交。
+    if (stopping) {
+      --pending;
+      task();
+      return;
+    }
+
+    auto index = currentScheduler == this
+                     ? currentWorker
+                     : nextWorker.fetch_add(1) % workers.size();
+    {
+      auto &worker = *workers[index];
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      worker.queues[priority].push_back(std::move(task));
+    }
+    // 与 Run 中“先登记 sleeping 再检查 pending”配对：这里读到 0 时对方必然
+    // 已看到新的 pending；否则持锁一次，保证对方已进入等待后再通知。
+    if (sleeping > 0) {
+      {
+        std::lock_guard<std::mutex> lock(idleMutex);
+      }
+      idle.notify_one();
+    }
+  }
+
+  template <typename Function>
+  auto Submit(Priority priority, Function function)
+      -> std::future<std::invoke_result_t<Function &>> {
+    using Result = std::invoke_result_t<Function &>;
+    auto task =
+        std::make_shared<std::packaged_task<Result()>>(std::move(function));
+    auto future = task->get_future();
+    Post(priority, [task]() { (*task)(); });
+    return future;
+  }
+
+  // 把 [begin, end) 按 grain 切块并行执行 function(i)。调用线程也参与执行，
+  // 在工作线程内嵌套调用不会死锁；返回时所有迭代都已完成。
+  template <typename Function>
+  void ParallelFor(std::size_t begin, std::size_t end, std::size_t grain,
+                   Function &&function, Priority priority = Decode) {
+    if (begin >= end)
+      return;
+    grain = (std::max)(grain, std::size_t(1));
+    auto chunks = (end - begin + grain - 1) / grain;
+
+    struct State {
+      std::atomic<std::size_t> next{0};
+      std::atomic<std::size_t> done{0};
+      std::mutex mutex;
+      std::condition_variable finished;
+    };
+    auto state = std::make_shared<State>();
+    // 分块全部领完后才开始执行的辅助任务不会再访问 function。
+    auto body = [state, begin, end, grain, chunks, &function]() {
+      for (auto chunk = state->next.fetch_add(1); chunk < chunks;
+           chunk = state->next.fetch_add(1)) {
+        auto first = begin + chunk * grain;
+        auto last = (std::min)(end, first + grain);
+        for (auto i = first; i < last; ++i)
+          function(i);
+        if (state->done.fetch_add(1) + 1 == chunks) {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          state->finished.notify_all();
+        }
+      }
+    };
+
+    auto helpers = (std::min)(chunks - 1, workers.size());
+    for (std::size_t i = 0; i < helpers; ++i)
+      Post(priority, body);
+    body();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&]() { return state->done == chunks; });
+  }
+
+  std::size_t size() const { return workers.size(); }
+
+private:
+  struct Worker {
+    std::mutex mutex;
+    std::array<std::deque<std::function<void()>>, PriorityCount> queues;
+    std::thread thread;
+  };
+
+  void Run(std::size_t index) {
+    currentScheduler = this;
+    currentWorker = index;
+    Trace::SetThreadName("worker");
+
+    while (true) {
+      std::function<void()> task;
+      if (Take(index, task)) {
+        task();
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(idleMutex);
+      if (stopping && pending == 0)
+        break;
+      ++sleeping;
+      idle.wait(lock, [this]() { return stopping || pending > 0; });
+      --sleeping;
+    }
+  }
+
+  // 按优先级从高到低：先取本线程队列尾部，再从其他线程队列头部窃取。
+  bool Take(std::size_t self, std::function<void()> &task) {
+    for (int priority = 0; priority < PriorityCount; ++priority) {
+      for (std::size_t offset = 0; offset < workers.size(); ++offset) {
+        auto index = (self + offset) % workers.size();
+        auto &worker = *workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        auto &queue = worker.queues[priority];
+        if (queue.empty())
+          continue;
+        if (index == self) {
+          task = std::move(queue.back());
+          queue.pop_back();
+        } else {
+          task = std::move(queue.front());
+          queue.pop_front();
+        }
+        --pending;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<std::size_t> nextWorker{0};
+  std::mutex idleMutex;
+  std::condition_variable idle;
+  std::atomic<std::size_t> pending{0};  // 已提交未取走的任务数
+  std::atomic<std::size_t> sleeping{0}; // 在 idle 上等待的工作线程数
+  std::atomic<bool> stopping{false};
+
+  inline static thread_local Scheduler *currentScheduler = nullptr;
+  inline static thread_local std::size_t currentWorker = 0;
+};
+
+// 在 wWinMain 中创建，退出前销毁。
+std::unique_ptr<Scheduler> gScheduler;
+
 class Notepad {
 public:
+  // 字体在后台加载，加载完成前 write 不输出任何内容。
   Notepad() {
-    std::filesystem::path path(wil::GetModuleFileNameW<std::wstring>(nullptr));
-    path = path.parent_path().append("msyh.ttf");
-    if (std::filesystem::exists(path)) {
-      auto multi_byte_path = SysWideToMultiByte(path.c_str(), CP_ACP);
-      auto result = TTF_Init();
-      font = TTF_OpenFont(multi_byte_path.c_str(), 12);
+    if (TTF_Init() == 0) {
+      loading = gScheduler->Submit(Scheduler::Background,
+                                   []() { return OpenFont(12); });
     }
   }
   ~Notepad() {
-    TTF_CloseFont(font);
+    if (loading.valid())
+      font = loading.get();
+    CloseFont(font);
     font = nullptr;
     TTF_Quit();
   }
@@ -83,6 +427,16 @@ public:
       return;
     }
 
+    if (!font) {
+      using namespace std::chrono_literals;
+      if (!loading.valid() ||
+          loading.wait_for(0s) != std::future_status::ready)
+        return;
+      font = loading.get();
+      if (!font)
+        return;
+    }
+
     SDL_Color color = {255, 0, 0, 255};
     auto surface = TTF_RenderText_Blended(font, text.c_str(), color);
     auto texture = SDL_CreateTextureFromSurface(render, surface);
@@ -92,8 +446,16 @@ public:
     SDL_FreeSurface(surface);
   }
 
+  // 阻塞等待字体加载完成，供基准测试等非交互场景使用。
+  bool wait() {
+    if (!font && loading.valid())
+      font = loading.get();
+    return font != nullptr;
+  }
+
 private:
   TTF_Font *font = nullptr;
+  std::future<TTF_Font *> loading;
 };
 
 void SDL_RenderDrawCircle(SDL_Renderer *render, int x, int y, int radius) {
@@ -139,6 +501,147 @@ private:
   Uint64 startCounter = SDL_GetPerformanceCounter();
 };
 
+// 播放管线时间线追踪，输出 Chrome trace_event JSON（可用 Perfetto 查看）。
+// 每个线程独占一个固定容量的环形缓冲区，记录时只有本线程写入、无锁；写满后覆盖
+// 最旧事件，因此长期开启也只保留最近一段时间窗口。
+namespace Trace {
+
+struct Event {
+  const char *name;
+  Uint64 begin;
+  Uint64 end;
+};
+
+struct ThreadBuffer {
+  static constexpr std::size_t capacity = 1 << 15;
+  DWORD threadId = 0;
+  const char *threadName = nullptr;
+  std::atomic<std::size_t> written{0};
+  std::array<Event, capacity> events;
+};
+
+std::atomic<bool> gEnabled{false};
+std::mutex gBuffersMutex;
+// 缓冲区在线程退出后仍保留，进程结束前不会释放。
+std::vector<std::unique_ptr<ThreadBuffer>> gBuffers;
+const Uint64 gStartCounter = SDL_GetPerformanceCounter();
+
+ThreadBuffer *LocalBuffer() {
+  thread_local ThreadBuffer *buffer = nullptr;
+  if (!buffer) {
+    auto owned = std::make_unique<ThreadBuffer>();
+    owned->threadId = GetCurrentThreadId();
+    buffer = owned.get();
+    std::lock_guard<std::mutex> lock(gBuffersMutex);
+    gBuffers.push_back(std::move(owned));
+  }
+  return buffer;
+}
+
+void SetThreadName(const char *name) {
+  if (gEnabled.load(std::memory_order_relaxed))
+    LocalBuffer()->threadName = name;
+}
+
+void Record(const char *name, Uint64 begin, Uint64 end) {
+  auto buffer = LocalBuffer();
+  auto index = buffer->written.load(std::memory_order_relaxed);
+  buffer->events[index % ThreadBuffer::capacity] = {name, begin, end};
+  buffer->written.store(index + 1, std::memory_order_release);
+}
+
+// 作用域事件：未开启追踪时只有一次原子读。
+class Scope {
+public:
+  explicit Scope(const char *name)
+      : name(gEnabled.load(std::memory_order_relaxed) ? name : nullptr) {
+    if (this->name)
+      begin = SDL_GetPerformanceCounter();
+  }
+  ~Scope() {
+    if (name)
+      Record(name, begin, SDL_GetPerformanceCounter());
+  }
+
+private:
+  const char *name;
+  Uint64 begin = 0;
+};
+
+// 写出所有线程的事件。写出期间其他线程仍可继续记录，被覆盖的事件直接跳过。
+// 锁内只复制缓冲区列表，新线程注册缓冲区不会等待磁盘写入。
+bool Flush(const std::string &path) {
+  std::vector<ThreadBuffer *> buffers;
+  {
+    std::lock_guard<std::mutex> lock(gBuffersMutex);
+    for (const auto &buffer : gBuffers)
+      buffers.push_back(buffer.get());
+  }
+
+  std::FILE *file = nullptr;
+  fopen_s(&file, path.c_str(), "wb");
+  if (!file)
+    return false;
+
+  const double microseconds = 1000000.0 / SDL_GetPerformanceFrequency();
+  auto timestamp = [&](Uint64 counter) {
+    return counter > gStartCounter ? (counter - gStartCounter) * microseconds
+                                   : 0.0;
+  };
+
+  std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  bool first = true;
+  std::vector<Event> events;
+  for (auto buffer : buffers) {
+    if (buffer->threadName) {
+      std::fprintf(file,
+                   "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                   "\"tid\":%lu,\"args\":{\"name\":\"%s\"}}",
+                   first ? "" : ",",
+                   static_cast<unsigned long>(buffer->threadId),
+                   buffer->threadName);
+      first = false;
+    }
+
+    auto end = buffer->written.load(std::memory_order_acquire);
+    auto begin =
+        end > ThreadBuffer::capacity ? end - ThreadBuffer::capacity : 0;
+    events.clear();
+    for (auto index = begin; index < end; ++index) {
+      events.push_back(buffer->events[index % ThreadBuffer::capacity]);
+    }
+    // 拷贝期间被新事件覆盖的槽位不可信。写者可能正在写下标 overwritten
+    // 所在的槽位（尚未发布），它与下标 overwritten - capacity 共用，也要跳过。
+    auto overwritten = buffer->written.load(std::memory_order_acquire);
+    auto valid = overwritten >= ThreadBuffer::capacity
+                     ? overwritten - ThreadBuffer::capacity + 1
+                     : 0;
+    for (auto index = begin; index < end; ++index) {
+      if (index < valid)
+        continue;
+      const auto &event = events[index - begin];
+      std::fprintf(file,
+                   "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,"
+                   "\"ts\":%.3f,\"dur\":%.3f}",
+                   first ? "" : ",", event.name,
+                   static_cast<unsigned long>(buffer->threadId),
+                   timestamp(event.begin),
+                   timestamp(event.end) - timestamp(event.begin));
+      first = false;
+    }
+  }
+  std::fprintf(file, "]}\n");
+  std::fclose(file);
+  return true;
+}
+
+} // namespace Trace
+
+#define FF_TRACE_CONCAT_INNER(a, b) a##b
+#define FF_TRACE_CONCAT(a, b) FF_TRACE_CONCAT_INNER(a, b)
+#define FF_TRACE_SCOPE(name)                                                   \
+  Foundation::Trace::Scope FF_TRACE_CONCAT(traceScope, __LINE__)(name)
+
 namespace Particle {
 
 struct World {
@@ -321,434 +824,3355 @@ int get_channel_layout_nb_channels(int64_t layout) {
   return nb_channels;
 }
 
-class AudioStream;
-std::unique_ptr<AudioStream> gLocalAudioStream;
-std::unique_ptr<AudioStream> gFFmpegAudioStream;
+// AVPacket 复用池
+// AVPacket 必须经由 av_packet_alloc/av_packet_free 管理，这里回收已 unref
+// 的空壳，稳态下解复用不再为每个包申请 AVPacket；负载缓冲区随 unref 归还。
+class PacketPool {
+public:
+  explicit PacketPool(std::size_t capacity = 256) {
+    idlePackets.reserve(capacity);
+  }
+  ~PacketPool() {
+    for (auto packet : idlePackets) {
+      av_packet_free(&packet);
+    }
+    idlePackets.clear();
+  }
 
-class VideoStream;
-std::unique_ptr<VideoStream> gFFmpegVideoStream;
+  AVPacket *acquire() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!idlePackets.empty()) {
+        auto packet = idlePackets.back();
+        idlePackets.pop_back();
+        return packet;
+      }
+    }
+    return av_packet_alloc();
+  }
 
-// 采样率: 48000，1s中的采样次数
-// 采样大小：位深度，一个采样使用多少bit存放，16bit
-// 声道数：2
-// 时间：1s
-constexpr int gAudioMaxFrameSize = 48000 * 16 * 2 * 1 / 8;
+  void release(AVPacket *packet) {
+    if (!packet)
+      return;
 
-constexpr std::size_t gInvalidVernier =
-    (std::numeric_limits<std::size_t>::max)();
+    av_packet_unref(packet);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (idlePackets.size() < idlePackets.capacity()) {
+        idlePackets.push_back(packet);
+        return;
+      }
+    }
+    av_packet_free(&packet);
+  }
 
-// 采样时间间隔：每采取一帧音频数据所需的时间间隔
-// 采样间隔：如果为20ms，则一秒采集50次
-// 每帧音频大小：gAudioPreFrameSize=gAudioMaxFrameSize/50
-// 每个通道样本数: gAudioPreChannelFrameSize=gAudioPreFrameSize/2
+private:
+  std::mutex mutex;
+  std::vector<AVPacket *> idlePackets;
+};
 
-class AudioStream {
+PacketPool gPacketPool;
+
+// 按字节预算限制的包队列
+// 环形数组存放，入队/出队不产生节点分配；超出预算时 push 返回 false，
+// 包的所有权仍归调用方，由调用方决定等待还是丢弃。
+class PacketQueue {
 public:
-  AudioStream(AVCodecContext *audioCodecContext)
-      : _audioCodecContext(audioCodecContext) {
-    SDL_AudioSpec spec;
-    {
-      memset(&spec, 0, sizeof(spec));
-      spec.freq = 44100;          // 采样率
-      spec.format = AUDIO_S16SYS; // 数据格式
-      spec.channels = get_channel_layout_nb_channels(
-          AV_CH_LAYOUT_STEREO); // 声道数：1单声道，2立体声
-      spec.silence = 0;         // 静音的值
-      spec.samples = 1024;      // 采样个数，2的N次方
-      spec.userdata = nullptr;  // 自定义数据
-      spec.callback = &AudioStream::ReadMixAudioData;
-      spec.userdata = nullptr;
+  PacketQueue(PacketPool &pool, std::size_t maxBytes, std::size_t maxPackets)
+      : pool(pool), ring(maxPackets, nullptr), maxBytes(maxBytes) {}
+  ~PacketQueue() { clear(); }
 
-      auto maxAudioFrameSize = AudioBufferSize;
-      AudioBufferSize = av_samples_get_buffer_size(
-          nullptr, spec.channels, spec.samples, AV_SAMPLE_FMT_S16, 1);
+  bool push(AVPacket *packet) {
+    if (!packet)
+      return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // 队列为空时总是接收，避免单个超大包永远无法入队。
+    if (count == ring.size() ||
+        (count > 0 && queuedBytes + packet->size > maxBytes)) {
+      return false;
     }
 
-    auto result = SDL_OpenAudio(&spec, NULL);
+    ring[(head + count) % ring.size()] = packet;
+    ++count;
+    queuedBytes += packet->size;
+    return true;
+  }
 
-    if (_audioCodecContext) {
-      audioSwresampleContext = swr_alloc();
+  AVPacket *pop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (count == 0)
+      return nullptr;
 
-      AVChannelLayout input_channel_layout;
-      av_channel_layout_from_mask(&input_channel_layout, AV_CH_LAYOUT_STEREO);
-      swr_alloc_set_opts2(&audioSwresampleContext, &input_channel_layout,
-                          AV_SAMPLE_FMT_S16, spec.freq,
-                          &_audioCodecContext->ch_layout,
-                          _audioCodecContext->sample_fmt,
-                          _audioCodecContext->sample_rate, 0, nullptr);
-      av_channel_layout_uninit(&input_channel_layout);
+    auto packet = ring[head];
+    ring[head] = nullptr;
+    head = (head + 1) % ring.size();
+    --count;
+    queuedBytes -= packet->size;
+    return packet;
+  }
 
-      swr_init(audioSwresampleContext);
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (; count > 0; --count) {
+      pool.release(ring[head]);
+      ring[head] = nullptr;
+      head = (head + 1) % ring.size();
+    }
+    head = 0;
+    queuedBytes = 0;
+  }
 
-      // Allocate video frame.
-      frame = av_frame_alloc();
+  std::size_t bytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return queuedBytes;
+  }
 
-      bufferSize = gAudioMaxFrameSize * 3 / 2;
-    } else {
-      std::filesystem::path path(
-          wil::GetModuleFileNameW<std::wstring>(nullptr));
-      path = path.parent_path().append("demo.pcm");
-      if (std::filesystem::exists(path)) {
-        auto multi_byte_path = SysWideToMultiByte(path.c_str(), CP_ACP);
-        auto r = fopen_s(&handle, multi_byte_path.c_str(), "rb");
-        if (handle) {
-          fseek(handle, 0, SEEK_END);
-          auto size = ftell(handle);
-          rewind(handle);
+  std::size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return count;
+  }
 
-          bufferSize = AudioBufferSize;
+private:
+  PacketPool &pool;
+  mutable std::mutex mutex;
+  std::vector<AVPacket *> ring;
+  std::size_t head = 0;
+  std::size_t count = 0;
+  std::size_t queuedBytes = 0;
+  std::size_t maxBytes = 0;
+};
+
+// 单调递增的墙上时间（秒）。
+double WallSeconds() {
+  static const double frequency =
+      static_cast<double>(SDL_GetPerformanceFrequency());
+  return SDL_GetPerformanceCounter() / frequency;
+}
+
+// 播放时钟
+// 以首帧 pts 为锚点、按播放速率推进的媒体时间（秒）。锚点只在主线程读写，
+// 速率为原子量，音频线程据此调整变速滤镜。实际速率是用户选择的速率乘以直播
+// 追赶系数，两者各自设置，互不覆盖。
+class PlaybackClock {
+public:
+  static constexpr double minRate = 0.25;
+  static constexpr double maxRate = 4.0;
+
+  double now() const {
+    if (!isAnchored)
+      return 0;
+    return mediaAnchor + (WallSeconds() - wallAnchor) * rate();
+  }
+
+  bool anchored() const { return isAnchored; }
+
+  void anchor(double mediaTime) {
+    mediaAnchor = mediaTime;
+    wallAnchor = WallSeconds();
+    isAnchored = true;
+  }
+
+  double rate() const { return playbackRate.load(std::memory_order_relaxed); }
+
+  // 用户选择的速率。
+  void setRate(double rate) {
+    userRate = (std::min)((std::max)(rate, minRate), maxRate);
+    Apply();
+  }
+
+  // 直播追赶系数，1.0 表示不追赶。
+  void setCatchUp(double factor) {
+    if (factor == catchUp)
+      return;
+    catchUp = factor;
+    Apply();
+  }
+
+  // 在预设档位间切换：direction > 0 加速，< 0 减速。
+  void stepRate(int direction) {
+    static constexpr double rates[] = {0.25, 0.5, 0.75, 1.0, 1.25,
+                                       1.5,  2.0, 3.0,  4.0};
+    auto current = userRate;
+    if (direction > 0) {
+      for (auto value : rates) {
+        if (value > current + 0.001) {
+          setRate(value);
+          return;
+        }
+      }
+    } else if (direction < 0) {
+      for (auto it = std::rbegin(rates); it != std::rend(rates); ++it) {
+        if (*it < current - 0.001) {
+          setRate(*it);
+          return;
         }
       }
     }
+  }
 
-    buffer = std::make_unique<char[]>(bufferSize + 1);
-    std::memset(buffer.get(), 0, bufferSize + 1);
+private:
+  // 变速时以当前媒体时间重新锚定，保证时钟连续。
+  void Apply() {
+    if (isAnchored)
+      anchor(now());
+    playbackRate.store(userRate * catchUp, std::memory_order_relaxed);
+  }
 
-    // SDL_AudioInit("directsound");
-    SDL_PauseAudio(0);
+  std::atomic<double> playbackRate{1.0};
+  double userRate = 1.0;
+  double catchUp = 1.0;
+  double mediaAnchor = 0;
+  double wallAnchor = 0;
+  bool isAnchored = false;
+};
+
+PlaybackClock gPlaybackClock;
+
+// 显示节奏调度
+// 由每次 Present 返回的时间估计真实刷新间隔（丢失的 vsync 按整数倍折算），
+// 按内容帧率规划稳定的节奏（如 60Hz 上 24fps 的 3:2 下拉），把每一帧排到确定的
+// vsync 上显示，而不是 Paint 碰巧执行时就显示。节奏以某一帧为锚点推算，播放
+// 时钟跳变、变速或刷新率估计漂移超过 1.5 个 vsync 时重新锚定。实际落在的 vsync
+// 与计划不符记一次节奏误差。只在主线程使用。
+class PresentationScheduler {
+public:
+  void SetNominalRefresh(int hz) {
+    if (hz > 0)
+      nominalPeriod = 1.0 / hz;
   }
-  ~AudioStream() {
 
-    if (handle) {
-      fclose(handle);
-      handle = nullptr;
-    }
+  // 刷新间隔（秒）：样本足够时取最近样本的中位数，否则用显示模式的标称值。
+  double period() const {
+    if (sampleCount < minSamples)
+      return nominalPeriod;
+    auto count = (std::min)(sampleCount, samples.size());
+    std::array<double, maxSamples> sorted;
+    std::copy(samples.begin(), samples.begin() + count, sorted.begin());
+    std::nth_element(sorted.begin(), sorted.begin() + count / 2,
+                     sorted.begin() + count);
+    return sorted[count / 2];
+  }
 
-    if (frame)
-      av_frame_free(&frame);
-    frame = nullptr;
+  // 本次 Paint 的 Present 预计落在的 vsync。
+  int64_t UpcomingVsync() const {
+    if (lastPresent <= 0)
+      return vsync + 1;
+    auto elapsed = WallSeconds() - lastPresent;
+    return vsync + 1 + static_cast<int64_t>(floor(elapsed / period()));
+  }
+
+  // 每个新帧调用一次：尚未锚定、速率改变或该帧的计划 vsync 偏离播放时钟
+  // 超过 1.5 个 vsync 时，以该帧重新锚定节奏。
+  void Reanchor(double mediaTime) {
+    auto rate = gPlaybackClock.rate();
+    auto ideal = VsyncAt(WallSeconds() +
+                         (mediaTime - gPlaybackClock.now()) / rate);
+    if (anchored && rate == anchorRate &&
+        fabs(Planned(mediaTime, period()) - ideal) <= 1.5)
+      return;
+    if (anchored)
+      ++cadenceResets;
+    anchored = true;
+    anchorVsync = llround(ideal);
+    anchorMedia = mediaTime;
+    anchorRate = rate;
+  }
+
+  // 媒体时间 mediaTime 的帧按当前节奏计划显示的 vsync，不改变锚点。
+  int64_t TargetVsync(double mediaTime) const {
+    return llround(floor(Planned(mediaTime, period()) + 0.5));
+  }
 
-    for (auto it = packets.begin(); it != packets.end(); ++it) {
-      av_packet_unref(it->get());
+  // Read 上传一帧后登记它的计划 vsync，由 OnPresent 核对。
+  void Queue(int64_t target) {
+    queuedTarget = target;
+    queued = true;
+  }
+
+  // 每次 SDL_RenderPresent 返回后调用。
+  void OnPresent() {
+    auto now = WallSeconds();
+    if (lastPresent > 0) {
+      auto interval = now - lastPresent;
+      auto p = period();
+      auto vsyncs = (std::max)(int64_t(1), int64_t(llround(interval / p)));
+      if (interval > p / 4 && vsyncs <= 4)
+        AddSample(interval / vsyncs);
+      vsync += vsyncs;
     }
-    packets.clear();
+    lastPresent = now;
 
-    if (packet) {
-      av_packet_unref(packet.get());
-      packet = nullptr;
+    if (queued) {
+      queued = false;
+      ++presentedFrames;
+      if (vsync != queuedTarget)
+        ++cadenceErrors;
     }
+  }
 
-    if (audioSwresampleContext) {
-      swr_free(&audioSwresampleContext);
+  // 例如 "3:2 59.94Hz err 0.5%"：节奏为每帧停留的 vsync 数的一个循环。
+  std::string Describe(double frameDuration) const {
+    auto p = period();
+    auto ratio = frameDuration / (p * gPlaybackClock.rate());
+    constexpr int count = 12;
+    std::array<int64_t, count> holds;
+    for (int n = 0; n < count; ++n) {
+      holds[n] = static_cast<int64_t>(floor((n + 1) * ratio + 0.5) -
+                                      floor(n * ratio + 0.5));
+    }
+    int cycle = 6;
+    for (int candidate = 1; candidate < cycle; ++candidate) {
+      bool repeats = true;
+      for (int n = candidate; n < count && repeats; ++n)
+        repeats = holds[n] == holds[n % candidate];
+      if (repeats)
+        cycle = candidate;
     }
-    audioSwresampleContext = nullptr;
 
-    buffer = nullptr;
+    std::string pattern;
+    for (int n = 0; n < cycle; ++n)
+      pattern += (n ? ":" : "") + std::to_string(holds[n]);
+    char text[96] = {0};
+    std::snprintf(text, sizeof(text), "%s %.2fHz err %.1f%%", pattern.c_str(),
+                  1.0 / p, errorRate() * 100);
+    return text;
   }
 
-  // stream指向需要填充的音频缓冲区
-  // length音频缓冲区大小，字节单位
-  static void ReadMixAudioData(void *userdata, Uint8 *stream, int length) {
-    SDL_memset(stream, 0, length);
-    if (length == 0 || (!gLocalAudioStream && !gFFmpegAudioStream))
-      return;
+  double errorRate() const {
+    return presentedFrames ? cadenceErrors * 1.0 / presentedFrames : 0;
+  }
+  std::size_t resets() const { return cadenceResets; }
 
-    if (gLocalAudioStream) {
+private:
+  static constexpr std::size_t maxSamples = 120;
+  static constexpr std::size_t minSamples = 10;
 
-      auto data = gLocalAudioStream->read(length);
-      if (data == nullptr || length == 0) {
-        return;
-      }
+  double Planned(double mediaTime, double p) const {
+    return anchorVsync + (mediaTime - anchorMedia) / (p * anchorRate);
+  }
 
-      SDL_MixAudio(stream, reinterpret_cast<Uint8 *>(data), length,
-                   SDL_MIX_MAXVOLUME);
-    }
+  double VsyncAt(double wall) const {
+    auto p = period();
+    if (lastPresent <= 0)
+      return vsync + 1 + (wall - WallSeconds()) / p;
+    return vsync + (wall - lastPresent) / p;
+  }
 
-    if (gFFmpegAudioStream) {
-      auto data = gFFmpegAudioStream->read(length);
-      if (data == nullptr || length == 0) {
-        return;
-      }
+  void AddSample(double interval) {
+    samples[sampleCount % maxSamples] = interval;
+    ++sampleCount;
+  }
 
-      SDL_MixAudio(stream, reinterpret_cast<Uint8 *>(data), length,
-                   SDL_MIX_MAXVOLUME);
+  double nominalPeriod = 1.0 / 60;
+  std::array<double, maxSamples> samples = {};
+  std::size_t sampleCount = 0;
+  int64_t vsync = 0;       // 最近一次 Present 落在的 vsync 序号
+  double lastPresent = 0;  // 最近一次 Present 返回的墙上时间
+
+  bool anchored = false;
+  int64_t anchorVsync = 0;
+  double anchorMedia = 0;
+  double anchorRate = 1.0;
+
+  bool queued = false;
+  int64_t queuedTarget = 0;
+  std::size_t presentedFrames = 0;
+  std::size_t cadenceErrors = 0;
+  std::size_t cadenceResets = 0;
+};
+
+PresentationScheduler gPresentation;
+
+// 直播延迟控制
+// 以到达最早（相对其 pts）的视频包为基准，估算每帧显示时相对“无缓冲”节奏的累计
+// 延迟，即播放器自身的接收到显示延迟，不含采集、编码和传输。这是播放器能够
+// 控制的部分：略超目标时小幅加速播放时钟（音频经 atempo 保持音调），严重超标时
+// 把时钟前移，由 VideoStream::Read 丢弃过期帧追赶。
+// 端到端（采集到显示）延迟只能在源端 pts 就是采集时墙上时间时测量：
+// --wallclock-pts 下以本机 UTC 时间减去 pts，按 pts 回绕周期取模，要求两端时钟
+// 同步，本机自测天然满足。
+// 离线测试：
+//   ffmpeg -re -f lavfi -i testsrc2=rate=30 -f lavfi -i sine -c:v libx264
+//          -tune zerolatency -c:a aac -f mpegts udp://127.0.0.1:1234
+//   FFPlayer.exe --live --input udp://127.0.0.1:1234 --latency 150
+// 端到端：
+//   ffmpeg -re -use_wallclock_as_timestamps 1 -f lavfi -i testsrc2=rate=30
+//          -c:v libx264 -tune zerolatency -copyts -muxdelay 0 -f mpegts
+//          udp://127.0.0.1:1234
+//   FFPlayer.exe --live --wallclock-pts --input udp://127.0.0.1:1234
+class LatencyController {
+public:
+  static constexpr double catchUpRate = 1.1;
+
+  // wrapPeriod：pts 回绕周期（秒），0 表示不回绕。
+  LatencyController(double target, bool wallclockPts, double wrapPeriod)
+      : target(target), wallclockPts(wallclockPts), wrapPeriod(wrapPeriod) {}
+
+  // 解复用线程：记录视频包到达时间。
+  void OnPacket(double pts) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto baseline = WallSeconds() - pts;
+    if (!anchored || baseline < arrivalBaseline) {
+      arrivalBaseline = baseline;
+      anchored = true;
     }
   }
 
-  char *read(int &length) {
-    if (!buffer)
-      return nullptr;
+  // 主线程：帧即将显示时更新延迟并调整播放时钟。
+  void OnPresent(double pts) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!anchored)
+      return;
 
-    if (length >= AudioBufferSize) {
-      length = AudioBufferSize;
+    auto sample = WallSeconds() - (arrivalBaseline + pts);
+    smoothedLatency =
+        smoothedLatency < 0 ? sample : smoothedLatency * 0.9 + sample * 0.1;
+
+    if (wallclockPts) {
+      auto endToEnd = av_gettime() / 1000000.0 - pts;
+      if (wrapPeriod > 0) {
+        endToEnd = fmod(endToEnd, wrapPeriod);
+        if (endToEnd < 0)
+          endToEnd += wrapPeriod;
+        if (endToEnd >= wrapPeriod / 2)
+          endToEnd -= wrapPeriod;
+      }
+      smoothedEndToEnd = smoothedEndToEnd < 0
+                             ? endToEnd
+                             : smoothedEndToEnd * 0.9 + endToEnd * 0.1;
     }
 
-    if (_audioCodecContext) {
-      if (vernier != gInvalidVernier) {
-        auto pos = buffer.get() + (AudioBufferSize - vernier);
-        if (length >= vernier) {
-          length = vernier;
-          vernier = gInvalidVernier;
-          return pos;
-        }
-        vernier -= length;
-        return pos;
-      }
+    if (smoothedLatency > target * 3) {
+      gPlaybackClock.anchor(gPlaybackClock.now() + smoothedLatency - target);
+      smoothedLatency = target;
+      ++skips;
+    } else if (smoothedLatency > target * 1.25) {
+      gPlaybackClock.setCatchUp(catchUpRate);
+    } else if (smoothedLatency <= target) {
+      gPlaybackClock.setCatchUp(1.0);
+    }
+  }
 
-      if (!packet) {
-        if (packets.empty())
-          return nullptr;
-        packet.reset(packets.front().release());
-        packets.pop_front();
-        if (!packet)
-          return nullptr;
-        avcodec_send_packet(_audioCodecContext, packet.get());
-      }
+  // 接收到显示的延迟（秒）。
+  double latency() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return smoothedLatency;
+  }
 
-      if (avcodec_receive_frame(_audioCodecContext, frame) != 0) {
-        av_packet_unref(packet.get());
-        packet = nullptr;
-        return read(length);
-      }
+  // 端到端延迟（秒），未启用 --wallclock-pts 或尚无数据时为负数。
+  double endToEndLatency() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return smoothedEndToEnd;
+  }
 
-      auto out = reinterpret_cast<uint8_t *>(buffer.get());
-      auto in = const_cast<const uint8_t **>(frame->data);
+  std::size_t skipped() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return skips;
+  }
 
-      auto result = swr_convert(audioSwresampleContext, &out,
-                                gAudioMaxFrameSize, in, frame->nb_samples);
-      if (result == AVERROR(EAGAIN) || result == AVERROR_EOF) {
-        av_packet_unref(packet.get());
-        packet = nullptr;
-        return read(length);
-      } else if (result < 0) {
-        return nullptr;
-      }
+private:
+  mutable std::mutex mutex;
+  double target = 0;
+  bool wallclockPts = false;
+  double wrapPeriod = 0;
+  double arrivalBaseline = 0;
+  double smoothedLatency = -1;
+  double smoothedEndToEnd = -1;
+  bool anchored = false;
+  std::size_t skips = 0;
+};
 
-      vernier = AudioBufferSize;
-      return read(length);
+// 解码降级控制
+// 以每帧解码耗时与帧间隔（按播放速率换算）之比衡量 CPU 压力。持续超载或出现过期
+// 丢帧时逐级降级：跳过环路滤波 → 非参考帧跳过 IDCT → 丢弃非参考帧 → lowres
+// 解码。恢复需要比降级长得多的连续余量；刚恢复就再次超载时，下次恢复所需的时间
+// 加倍，避免在两级之间来回抖动。只在主线程使用。
+class DecodeDegradation {
+public:
+  enum Level {
+    Full,
+    SkipLoopFilter,
+    SkipIdct,
+    SkipNonReference,
+    LowResolution,
+  };
 
-    } else if (handle) {
-      if (feof(handle)) {
-        rewind(handle);
-      }
+  static constexpr double overloadRatio = 0.8; // 解码耗时占帧间隔的比例上限
+  static constexpr double headroomRatio = 0.4; // 低于该比例视为有余量
+  static constexpr int overloadFrames = 15;    // 连续超载帧数后降一级
+  static constexpr int headroomFrames = 150;   // 连续有余量帧数后升一级
+
+  explicit DecodeDegradation(Level maxLevel) : maxLevel(maxLevel) {}
+
+  static const char *Name(Level level) {
+    switch (level) {
+    case Full:
+      return "full";
+    case SkipLoopFilter:
+      return "skip loop filter";
+    case SkipIdct:
+      return "skip idct";
+    case SkipNonReference:
+      return "skip non-ref";
+    case LowResolution:
+      return "lowres";
+    }
+    return "";
+  }
 
-      auto audioSize =
-          fread_s(buffer.get(), AudioBufferSize, 1, length, handle);
-      if (audioSize != length) {
-        if (feof(handle)) {
-          length = audioSize;
-          return buffer.get();
-        }
-        return nullptr;
-      }
+  // 每解出一帧调用一次，级别变化时返回 true。
+  bool OnFrame(double decodeSeconds, double frameInterval) {
+    if (frameInterval <= 0)
+      return false;
+
+    auto ratio = decodeSeconds / frameInterval;
+    smoothedRatio =
+        smoothedRatio < 0 ? ratio : smoothedRatio * 0.9 + ratio * 0.1;
+    ++framesAtLevel;
+
+    if (smoothedRatio > overloadRatio || lateFrames > 0) {
+      ++overloaded;
+      relaxed = 0;
+    } else if (smoothedRatio < headroomRatio) {
+      ++relaxed;
+      overloaded = 0;
     } else {
-      return nullptr;
+      overloaded = 0;
+      relaxed = 0;
     }
+    lateFrames = 0;
 
-    return buffer.get();
+    if (overloaded >= overloadFrames && current < maxLevel) {
+      if (recovered && framesAtLevel < recoverFrames)
+        recoverFrames = (std::min)(recoverFrames * 2, headroomFrames * 8);
+      return Change(static_cast<Level>(current + 1), false);
+    }
+    if (relaxed >= recoverFrames && current > Full)
+      return Change(static_cast<Level>(current - 1), true);
+    return false;
   }
 
-  bool push(AVPacket *packet) {
-    packets.push_back(std::unique_ptr<AVPacket>(packet));
-    return true;
-  }
+  // 帧因过期被丢弃：解码已经跟不上显示节奏。
+  void OnLate() { ++lateFrames; }
 
-private:
-  // ffprobe.exe demo.mp3=>Audio: mp3, 44100 Hz, stereo, fltp, 320 kb/s
-  // ffmpeg.exe -y -i demo.mp3 -acodec pcm_s16le -f s16le -ac 2 -ar 44100
-  // demo.pcm
-  // =>demo.pcm
-  // ffplay -ar 44100 -channels 2 -f s16le -i demo.pcm
-  // =>audio
-  std::size_t AudioBufferSize = 1024 * 2 * SDL_AUDIO_BITSIZE(AUDIO_S16SYS) / 8;
-  std::unique_ptr<char[]> buffer;
-  std::size_t bufferSize = 0;
+  Level level() const { return current; }
 
-  AVCodecContext *_audioCodecContext = nullptr;
-  SwrContext *audioSwresampleContext = nullptr;
-  std::list<std::unique_ptr<AVPacket>> packets;
-  std::unique_ptr<AVPacket> packet;
-  AVFrame *frame = nullptr;
-  std::size_t vernier = gInvalidVernier;
+private:
+  bool Change(Level level, bool recovering) {
+    SDL_Log("decode degradation: %s -> %s", Name(current), Name(level));
+    current = level;
+    recovered = recovering;
+    overloaded = 0;
+    relaxed = 0;
+    framesAtLevel = 0;
+    smoothedRatio = -1;
+    return true;
+  }
 
-  std::FILE *handle = nullptr;
+  Level maxLevel = SkipNonReference;
+  Level current = Full;
+  double smoothedRatio = -1;
+  int overloaded = 0;
+  int relaxed = 0;
+  int lateFrames = 0;
+  int framesAtLevel = 0;
+  int recoverFrames = headroomFrames;
+  bool recovered = false;
 };
 
-class VideoStream {
-public:
-  VideoStream() {
-    std::filesystem::path path(wil::GetModuleFileNameW<std::wstring>(nullptr));
-    path = path.parent_path().append("demo.mp4");
+// 按 description 连接 source -> 滤镜链 -> sink 并配置滤镜图。
+int LinkFilterGraph(AVFilterGraph *graph, AVFilterContext *source,
+                    AVFilterContext *sink, const std::string &description) {
+  auto outputs = avfilter_inout_alloc();
+  auto inputs = avfilter_inout_alloc();
+  if (!outputs || !inputs) {
+    avfilter_inout_free(&outputs);
+    avfilter_inout_free(&inputs);
+    return AVERROR(ENOMEM);
+  }
 
-    [&]() {
-      if (!std::filesystem::exists(path))
-        return;
-      auto multi_byte_path = SysWideToMultiByte(path.c_str(), CP_ACP);
+  outputs->name = av_strdup("in");
+  outputs->filter_ctx = source;
+  outputs->pad_idx = 0;
+  outputs->next = nullptr;
 
-      // Open input file, result should be zero.
-      auto result = avformat_open_input(&formatContext, multi_byte_path.c_str(),
-                                        nullptr, nullptr);
-      if (result != 0)
-        return;
+  inputs->name = av_strdup("out");
+  inputs->filter_ctx = sink;
+  inputs->pad_idx = 0;
+  inputs->next = nullptr;
 
-      // Find video stream
-      videoStream = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1,
-                                        -1, nullptr, 0);
-      if (videoStream == -1)
-        return;
+  auto result = avfilter_graph_parse_ptr(graph, description.c_str(), &inputs,
+                                         &outputs, nullptr);
+  avfilter_inout_free(&outputs);
+  avfilter_inout_free(&inputs);
+  if (result < 0)
+    return result;
 
-      // Find video decoder and initialize a context.
-      auto videoCodecParameters = formatContext->streams[videoStream]->codecpar;
-      auto videoCodec = avcodec_find_decoder(videoCodecParameters->codec_id);
-      if (videoCodec == nullptr)
-        return;
-      videoCodecContext = avcodec_alloc_context3(videoCodec);
-      result = avcodec_parameters_to_context(videoCodecContext,
-                                             videoCodecParameters);
-      if (result != 0)
-        return;
+  return avfilter_graph_config(graph, nullptr);
+}
 
-      // open decoder.
-      result = avcodec_open2(videoCodecContext, videoCodec, nullptr);
-      if (result < 0)
-        return;
+// 固定容量的 AVFrame 环形队列：槽位预先分配，push 只增加引用、pop 只转移引用，
+// 不拷贝像素数据。非线程安全，由使用方加锁。
+class FrameQueue {
+public:
+  explicit FrameQueue(std::size_t capacity) : ring(capacity, nullptr) {
+    for (auto &slot : ring) {
+      slot = av_frame_alloc();
+    }
+  }
+  ~FrameQueue() {
+    for (auto &slot : ring) {
+      av_frame_free(&slot);
+    }
+  }
 
-      // Find audio stream
-      audioStream = av_find_best_stream(formatContext, AVMEDIA_TYPE_AUDIO, -1,
-                                        -1, nullptr, 0);
-      if (audioStream == -1)
-        return;
+  bool full() const { return count == ring.size(); }
+  bool empty() const { return count == 0; }
+  std::size_t size() const { return count; }
 
-      // Find audio decoder and initialize a context
-      auto audioCodecParameters = formatContext->streams[audioStream]->codecpar;
-      auto audioCodec = avcodec_find_decoder(audioCodecParameters->codec_id);
-      if (audioCodec == nullptr)
-        return;
-      audioCodecContext = avcodec_alloc_context3(audioCodec);
-      result = avcodec_parameters_to_context(audioCodecContext,
-                                             audioCodecParameters);
+  bool push(const AVFrame *frame) {
+    if (full() || av_frame_ref(ring[(head + count) % ring.size()], frame) < 0)
+      return false;
+    ++count;
+    return true;
+  }
 
-      if (result != 0)
-        return;
+  bool pop(AVFrame *frame) {
+    if (empty())
+      return false;
+    av_frame_unref(frame);
+    av_frame_move_ref(frame, ring[head]);
+    head = (head + 1) % ring.size();
+    --count;
+    return true;
+  }
 
-      // open decoder.
-      result = avcodec_open2(audioCodecContext, audioCodec, nullptr);
-      if (result < 0)
-        return;
+  void clear() {
+    for (auto &slot : ring) {
+      av_frame_unref(slot);
+    }
+    head = 0;
+    count = 0;
+  }
 
-      gFFmpegAudioStream = std::make_unique<AudioStream>(audioCodecContext);
+private:
+  std::vector<AVFrame *> ring;
+  std::size_t head = 0;
+  std::size_t count = 0;
+};
 
-      // Allocate video frame.
-      frame = av_frame_alloc();
+// 视频滤镜阶段
+// 解码帧以引用方式交给独立工作线程上的滤镜图（去隔行、裁剪、降噪、预缩放等），
+// 滤镜图内部启用 slice 多线程；输出统一为 yuv420p 以便直接上传 IYUV 纹理。
+// 流中途改变分辨率或像素格式时，与 ffmpeg 命令行一样先冲刷旧滤镜图，再按新
+// 参数重建。
+class VideoFilter {
+public:
+  VideoFilter(AVCodecContext *codecContext, AVStream *stream,
+              const std::string &description)
+      : description(description), streamTimeBase(stream->time_base) {
+    if (!Build(codecContext->width, codecContext->height,
+               codecContext->pix_fmt, codecContext->sample_aspect_ratio))
+      return;
 
-      _width = videoCodecContext->width;
-      _height = videoCodecContext->height;
-    }();
+    _width = av_buffersink_get_w(sink);
+    _height = av_buffersink_get_h(sink);
+    timeBase = av_buffersink_get_time_base(sink);
+    filteredFrame = av_frame_alloc();
+    worker = std::thread(&VideoFilter::Run, this);
   }
 
-  ~VideoStream() {
-    gFFmpegAudioStream.reset();
-
-    if (frame)
-      av_frame_free(&frame);
-    frame = nullptr;
+  ~VideoFilter() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    condition.notify_all();
+    if (worker.joinable())
+      worker.join();
+
+    input.clear();
+    output.clear();
+    if (filteredFrame)
+      av_frame_free(&filteredFrame);
+    avfilter_graph_free(&graph);
+  }
 
-    if (packet)
-      av_packet_unref(packet.get());
-    packet.reset();
+  bool valid() const { return graph != nullptr; }
+  int width() const { return _width; }
+  int height() const { return _height; }
+  AVRational time_base() const { return timeBase; }
 
-    if (videoCodecContext)
-      avcodec_close(videoCodecContext);
-    videoCodecContext = nullptr;
+  bool writable() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !input.full();
+  }
 
-    if (audioCodecContext) {
-      avcodec_close(audioCodecContext);
+  // 只增加引用计数，调用方仍可复用 frame。
+  bool push(const AVFrame *frame) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!input.push(frame))
+        return false;
     }
-    audioCodecContext = nullptr;
-
-    if (formatContext)
-      avformat_close_input(&formatContext);
-    formatContext = nullptr;
+    condition.notify_all();
+    return true;
   }
 
-  int width() const { return this->_width; }
-  int height() const { return this->_height; }
-
-  bool HasFrame() {
-    if (!packet) {
-      packet = std::make_unique<AVPacket>();
-      if (!packet)
-        return false;
-      if (av_read_frame(formatContext, packet.get()) < 0) {
-        av_packet_unref(packet.get());
-        packet = nullptr;
+  bool pop(AVFrame *frame) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!output.pop(frame))
         return false;
-      }
-      if (videoStream != packet->stream_index) {
-        if (!gFFmpegAudioStream || packet->stream_index != audioStream ||
-            !gFFmpegAudioStream->push(packet.release())) {
-          av_packet_unref(packet.get());
-          packet = nullptr;
-        }
-        return HasFrame();
-      }
-      avcodec_send_packet(videoCodecContext, packet.get());
     }
+    condition.notify_all();
+    return true;
+  }
 
-    if (avcodec_receive_frame(videoCodecContext, frame) != 0) {
-      av_packet_unref(packet.get());
-      packet = nullptr;
-      return HasFrame();
+  // 输入结束：已送入的帧处理完后向滤镜图发送 EOF，yadif、tmix 等缓存的最后
+  // 几帧随之输出。
+  void finish() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ending = true;
     }
-    return true;
+    condition.notify_all();
   }
 
-  bool Read(SDL_Texture *texture) {
-    if (!texture)
+private:
+  // 按输入参数（重新）创建滤镜图，只在构造和工作线程中调用。
+  bool Build(int width, int height, int format, AVRational aspect) {
+    avfilter_graph_free(&graph);
+    source = nullptr;
+    sink = nullptr;
+    graph = avfilter_graph_alloc();
+    if (!graph)
       return false;
-
-    if (!HasFrame()) {
+    // nb_threads 为 0 时由 libavfilter 按 CPU 核数决定线程数。
+    graph->thread_type = AVFILTER_THREAD_SLICE;
+    graph->nb_threads = 0;
+
+    if (aspect.num == 0 || aspect.den == 0)
+      aspect = av_make_q(1, 1);
+    auto arguments =
+        "video_size=" + std::to_string(width) + "x" + std::to_string(height) +
+        ":pix_fmt=" + std::to_string(format) +
+        ":time_base=" + std::to_string(streamTimeBase.num) + "/" +
+        std::to_string(streamTimeBase.den) +
+        ":pixel_aspect=" + std::to_string(aspect.num) + "/" +
+        std::to_string(aspect.den);
+
+    if (avfilter_graph_create_filter(&source, avfilter_get_by_name("buffer"),
+                                     "in", arguments.c_str(), nullptr,
+                                     graph) < 0 ||
+        avfilter_graph_create_filter(&sink,
+                                     avfilter_get_by_name("buffersink"), "out",
+                                     nullptr, nullptr, graph) < 0 ||
+        LinkFilterGraph(graph, source, sink,
+                        description + ",format=yuv420p") < 0) {
+      SDL_Log("video filter graph failed: %s (%s)", description.c_str(),
+              arguments.c_str());
+      avfilter_graph_free(&graph);
+      source = nullptr;
+      sink = nullptr;
       return false;
     }
 
-    SDL_UpdateYUVTexture(texture, nullptr, frame->data[0], frame->linesize[0],
-                         frame->data[1], frame->linesize[1], frame->data[2],
-                         frame->linesize[2]);
+    inputWidth = width;
+    inputHeight = height;
+    inputFormat = format;
     return true;
   }
 
-private:
-  AVFormatContext *formatContext = nullptr;
-  AVCodecContext *videoCodecContext = nullptr;
-  AVCodecContext *audioCodecContext = nullptr;
-  AVFrame *frame = nullptr;
-  int _width = 0;
-  int _height = 0;
-  int videoStream = -1;
-  int audioStream = -1;
-  std::unique_ptr<AVPacket> packet;
-};
+  // 取出滤镜图已产出的帧，输出队列满时等待主线程取走。
+  void Drain() {
+    while (av_buffersink_get_frame(sink, filteredFrame) >= 0) {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [this]() { return quit || !output.full(); });
+      if (!quit)
+        output.push(filteredFrame);
+      av_frame_unref(filteredFrame);
+    }
+  }
 
-} // namespace stream
+  void Run() {
+    Foundation::Trace::SetThreadName("video filter");
+    auto work = av_frame_alloc();
+    while (work) {
+      bool end = false;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock,
+                       [this]() { return quit || !input.empty() || ending; });
+        if (quit)
+          break;
+        if (input.empty()) {
+          end = true;
+          ending = false;
+        } else {
+          input.pop(work);
+        }
+      }
 
-namespace Foundation {
+      FF_TRACE_SCOPE("video filter");
+      if (end) {
+        if (graph) {
+          av_buffersrc_add_frame(source, nullptr);
+          Drain();
+        }
+        continue;
+      }
+      // 输入参数变化：冲刷旧滤镜图缓存的帧后重建。重建失败时丢弃帧直到
+      // 参数再次变化。
+      if (work->width != inputWidth || work->height != inputHeight ||
+          work->format != inputFormat) {
+        if (graph) {
+          av_buffersrc_add_frame(source, nullptr);
+          Drain();
+        }
+        SDL_Log("video filter: input %dx%d fmt %d, rebuilding", work->width,
+                work->height, work->format);
+        if (!Build(work->width, work->height, work->format,
+                   work->sample_aspect_ratio)) {
+          inputWidth = work->width;
+          inputHeight = work->height;
+          inputFormat = work->format;
+        }
+      }
+      if (!graph) {
+        av_frame_unref(work);
+        continue;
+      }
 
-class Window {
-public:
-  Window() {
-    window = SDL_CreateWindow("FFPlayer", SDL_WINDOWPOS_UNDEFINED,
-                              SDL_WINDOWPOS_UNDEFINED, 850, 600,
-                              SDL_WINDOW_RESIZABLE);
-    render = SDL_CreateRenderer(
-        window, -1,
-        /*SDL_RENDERER_SOFTWARE | */ SDL_RENDERER_ACCELERATED |
-            SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_TARGETTEXTURE);
+      // 不带 KEEP_REF：引用直接转交给滤镜图，避免再复制一次。
+      if (av_buffersrc_add_frame_flags(source, work, 0) < 0) {
+        av_frame_unref(work);
+        continue;
+      }
+      Drain();
+    }
+    av_frame_free(&work);
+  }
 
-    texture = SDL_CreateTexture(render, SDL_PIXELFORMAT_RGBA8888,
-                                SDL_TEXTUREACCESS_TARGET, 850, 600);
+  std::string description;
+  AVRational streamTimeBase = {1, AV_TIME_BASE};
+  int inputWidth = 0; // 当前滤镜图配置的输入参数
+  int inputHeight = 0;
+  int inputFormat = -1;
+  AVFilterGraph *graph = nullptr;
+  AVFilterContext *source = nullptr;
+  AVFilterContext *sink = nullptr;
+  AVFrame *filteredFrame = nullptr;
+  AVRational timeBase = {1, AV_TIME_BASE};
+  int _width = 0;
+  int _height = 0;
 
-    SDL_SetWindowMinimumSize(window, 750, 400);
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable condition;
+  FrameQueue input{4};
+  FrameQueue output{4};
+  bool ending = false;
+  bool quit = false;
+};
 
-    //SDL_FPoint gravity = {0, 0};
-    //world = Foundation::Particle::World::CreateWorld(gravity);
-    //SDL_Point position = {850 / 2, 600};
+class AudioStream;
+std::unique_ptr<AudioStream> gLocalAudioStream;
+std::unique_ptr<AudioStream> gFFmpegAudioStream;
+
+class VideoStream;
+std::unique_ptr<VideoStream> gFFmpegVideoStream;
+
+// 采样率: 48000，1s中的采样次数
+// 采样大小：位深度，一个采样使用多少bit存放，16bit
+// 声道数：2
+// 时间：1s
+constexpr int gAudioMaxFrameSize = 48000 * 16 * 2 * 1 / 8;
+
+// 音频包队列预算：320kb/s 的码流约可缓存 10s，超出后解复用等待音频线程消费。
+constexpr std::size_t gAudioQueueMaxBytes = 400 * 1024;
+constexpr std::size_t gAudioQueueMaxPackets = 1024;
+// 直播模式只缓存少量数据，宁可丢包也不累积延迟。视频队列的包数按目标延迟
+// 计算（见 VideoStream），字节数只防止异常大包。
+constexpr std::size_t gLiveAudioQueueMaxBytes = 32 * 1024;
+constexpr std::size_t gLiveVideoQueueMaxBytes = 1024 * 1024;
+
+constexpr std::size_t gInvalidVernier =
+    (std::numeric_limits<std::size_t>::max)();
+
+// 采样时间间隔：每采取一帧音频数据所需的时间间隔
+// 采样间隔：如果为20ms，则一秒采集50次
+// 每帧音频大小：gAudioPreFrameSize=gAudioMaxFrameSize/50
+// 每个通道样本数: gAudioPreChannelFrameSize=gAudioPreFrameSize/2
+
+class AudioStream {
+public:
+  AudioStream(AVCodecContext *audioCodecContext)
+      : _audioCodecContext(audioCodecContext) {
+    SDL_AudioSpec spec;
+    {
+      memset(&spec, 0, sizeof(spec));
+      spec.freq = 44100;          // 采样率
+      spec.format = AUDIO_S16SYS; // 数据格式
+      spec.channels = get_channel_layout_nb_channels(
+          AV_CH_LAYOUT_STEREO); // 声道数：1单声道，2立体声
+      spec.silence = 0;         // 静音的值
+      spec.samples = 1024;      // 采样个数，2的N次方
+      spec.userdata = nullptr;  // 自定义数据
+      spec.callback = &AudioStream::ReadMixAudioData;
+      spec.userdata = nullptr;
+
+      auto maxAudioFrameSize = AudioBufferSize;
+      AudioBufferSize = av_samples_get_buffer_size(
+          nullptr, spec.channels, spec.samples, AV_SAMPLE_FMT_S16, 1);
+    }
+
+    // 本地 PCM 与媒体音频共用同一个设备，后打开者失败属正常，是否可用以
+    // playing() 为准。
+    SDL_OpenAudio(&spec, NULL);
+    outputSampleRate = spec.freq;
+
+    if (_audioCodecContext) {
+      ConfigureResampler();
+
+      // Allocate video frame.
+      frame = av_frame_alloc();
+
+      bufferSize = gAudioMaxFrameSize * 3 / 2;
+    } else {
+      std::filesystem::path path(
+          wil::GetModuleFileNameW<std::wstring>(nullptr));
+      path = path.parent_path().append("demo.pcm");
+      if (std::filesystem::exists(path)) {
+        auto multi_byte_path = SysWideToMultiByte(path.c_str(), CP_ACP);
+        auto r = fopen_s(&handle, multi_byte_path.c_str(), "rb");
+        if (handle) {
+          fseek(handle, 0, SEEK_END);
+          auto size = ftell(handle);
+          rewind(handle);
+
+          bufferSize = AudioBufferSize;
+        }
+      }
+    }
+
+    buffer = std::make_unique<char[]>(bufferSize + 1);
+    std::memset(buffer.get(), 0, bufferSize + 1);
+
+    // SDL_AudioInit("directsound");
+    SDL_PauseAudio(0);
+  }
+  ~AudioStream() {
+
+    if (handle) {
+      fclose(handle);
+      handle = nullptr;
+    }
+
+    if (frame)
+      av_frame_free(&frame);
+    frame = nullptr;
+
+    avfilter_graph_free(&tempoGraph);
+    if (tempoFrame)
+      av_frame_free(&tempoFrame);
+    tempoFrame = nullptr;
+
+    packets.clear();
+
+    gPacketPool.release(packet);
+    packet = nullptr;
+
+    if (audioSwresampleContext) {
+      swr_free(&audioSwresampleContext);
+    }
+    audioSwresampleContext = nullptr;
+
+    buffer = nullptr;
+  }
+
+  // 音频设备已打开并在播放。没有设备（远程桌面、无声卡、被独占）时为 false，
+  // 此时回调不会运行，不能再向队列送包。
+  static bool playing() { return SDL_GetAudioStatus() == SDL_AUDIO_PLAYING; }
+
+  // 最近 0.5 秒内回调运行过：队列会被消费，满时值得等待。
+  static bool consuming() {
+    return WallSeconds() - lastCallback.load(std::memory_order_relaxed) < 0.5;
+  }
+
+  // stream指向需要填充的音频缓冲区
+  // length音频缓冲区大小，字节单位
+  static void ReadMixAudioData(void *userdata, Uint8 *stream, int length) {
+    Foundation::Trace::SetThreadName("audio");
+    FF_TRACE_SCOPE("audio callback");
+    lastCallback.store(WallSeconds(), std::memory_order_relaxed);
+    SDL_memset(stream, 0, length);
+    if (length == 0 || (!gLocalAudioStream && !gFFmpegAudioStream))
+      return;
+
+    if (gLocalAudioStream) {
+
+      auto data = gLocalAudioStream->read(length);
+      if (data == nullptr || length == 0) {
+        return;
+      }
+
+      SDL_MixAudio(stream, reinterpret_cast<Uint8 *>(data), length,
+                   SDL_MIX_MAXVOLUME);
+    }
+
+    if (gFFmpegAudioStream) {
+      auto data = gFFmpegAudioStream->read(length);
+      if (data == nullptr || length == 0) {
+        return;
+      }
+
+      SDL_MixAudio(stream, reinterpret_cast<Uint8 *>(data), length,
+                   SDL_MIX_MAXVOLUME);
+    }
+  }
+
+  char *read(int &length) {
+    if (!buffer)
+      return nullptr;
+
+    if (length >= AudioBufferSize) {
+      length = AudioBufferSize;
+    }
+
+    if (_audioCodecContext) {
+      if (vernier != gInvalidVernier) {
+        auto pos = buffer.get() + (bufferedBytes - vernier);
+        if (length >= vernier) {
+          length = vernier;
+          vernier = gInvalidVernier;
+          return pos;
+        }
+        vernier -= length;
+        return pos;
+      }
+
+      auto decoded = ReceiveFrame();
+      if (!decoded)
+        return nullptr;
+
+      // 输出固定为 S16 立体声，按缓冲区实际容量换算可写入的样本数。
+      constexpr int bytesPerSample = 2 * 2;
+      auto out = reinterpret_cast<uint8_t *>(buffer.get());
+      auto in = const_cast<const uint8_t **>(decoded->extended_data);
+
+      int result = 0;
+      {
+        FF_TRACE_SCOPE("swr_convert");
+        result = swr_convert(audioSwresampleContext, &out,
+                             static_cast<int>(bufferSize / bytesPerSample), in,
+                             decoded->nb_samples);
+      }
+      if (decoded == tempoFrame)
+        av_frame_unref(tempoFrame);
+      if (result == AVERROR(EAGAIN) || result == AVERROR_EOF || result == 0) {
+        return read(length);
+      } else if (result < 0) {
+        return nullptr;
+      }
+
+      bufferedBytes = static_cast<std::size_t>(result) * bytesPerSample;
+      vernier = bufferedBytes;
+      return read(length);
+
+    } else if (handle) {
+      if (feof(handle)) {
+        rewind(handle);
+      }
+
+      auto audioSize =
+          fread_s(buffer.get(), AudioBufferSize, 1, length, handle);
+      if (audioSize != length) {
+        if (feof(handle)) {
+          length = audioSize;
+          return buffer.get();
+        }
+        return nullptr;
+      }
+    } else {
+      return nullptr;
+    }
+
+    return buffer.get();
+  }
+
+  // 队列超出字节预算时返回 false，包仍归调用方所有。
+  bool push(AVPacket *packet) { return packets.push(packet); }
+
+  // 回调停止消费时丢弃最旧的包腾出位置，解复用不会因此停住视频。
+  void pushDroppingOldest(AVPacket *packet) {
+    while (!packets.push(packet)) {
+      auto oldest = packets.pop();
+      if (!oldest) {
+        gPacketPool.release(packet);
+        return;
+      }
+      gPacketPool.release(oldest);
+    }
+  }
+
+  // 切换音轨：丢弃旧音轨尚未播放的数据，按新解码器重建重采样与变速滤镜。
+  // context 与当前解码器相同时只清空解码器内部状态。调用方需持有音频锁。
+  void Switch(AVCodecContext *context) {
+    packets.clear();
+    gPacketPool.release(packet);
+    packet = nullptr;
+    vernier = gInvalidVernier;
+    bufferedBytes = 0;
+
+    avfilter_graph_free(&tempoGraph);
+    tempoSource = nullptr;
+    tempoSink = nullptr;
+    tempo = 1.0;
+
+    if (context == _audioCodecContext) {
+      avcodec_flush_buffers(context);
+    } else {
+      _audioCodecContext = context;
+    }
+    ConfigureResampler();
+  }
+
+private:
+  void ConfigureResampler() {
+    swr_free(&audioSwresampleContext);
+
+    AVChannelLayout input_channel_layout;
+    av_channel_layout_from_mask(&input_channel_layout, AV_CH_LAYOUT_STEREO);
+    swr_alloc_set_opts2(&audioSwresampleContext, &input_channel_layout,
+                        AV_SAMPLE_FMT_S16, outputSampleRate,
+                        &_audioCodecContext->ch_layout,
+                        _audioCodecContext->sample_fmt,
+                        _audioCodecContext->sample_rate, 0, nullptr);
+    av_channel_layout_uninit(&input_channel_layout);
+
+    swr_init(audioSwresampleContext);
+  }
+
+  // 取下一帧待重采样的音频：先取变速滤镜的输出，不足时继续解码送入滤镜。
+  // 运行在 SDL 音频线程，播放速率变化时在此重建滤镜图。
+  AVFrame *ReceiveFrame() {
+    auto rate = gPlaybackClock.rate();
+    if (rate != tempo) {
+      ConfigureTempo(rate);
+    }
+
+    while (true) {
+      if (tempoGraph && av_buffersink_get_frame(tempoSink, tempoFrame) >= 0) {
+        return tempoFrame;
+      }
+
+      if (!packet) {
+        packet = packets.pop();
+        if (!packet)
+          return nullptr;
+        FF_TRACE_SCOPE("audio avcodec_send_packet");
+        avcodec_send_packet(_audioCodecContext, packet);
+      }
+
+      int received = 0;
+      {
+        FF_TRACE_SCOPE("audio avcodec_receive_frame");
+        received = avcodec_receive_frame(_audioCodecContext, frame);
+      }
+      if (received != 0) {
+        gPacketPool.release(packet);
+        packet = nullptr;
+        continue;
+      }
+
+      if (!tempoGraph || av_buffersrc_add_frame(tempoSource, frame) < 0) {
+        return frame;
+      }
+    }
+  }
+
+  // atempo 单级只接受 [0.5, 2.0]，超出范围时串联多级；输出格式与解码器一致，
+  // 以便复用已初始化的重采样上下文。
+  void ConfigureTempo(double rate) {
+    avfilter_graph_free(&tempoGraph);
+    tempoSource = nullptr;
+    tempoSink = nullptr;
+    tempo = rate;
+    if (rate == 1.0)
+      return;
+
+    char layout[64] = {0};
+    av_channel_layout_describe(&_audioCodecContext->ch_layout, layout,
+                               sizeof(layout));
+    auto sampleFormat = av_get_sample_fmt_name(_audioCodecContext->sample_fmt);
+    auto sampleRate = std::to_string(_audioCodecContext->sample_rate);
+
+    std::string chain;
+    for (; rate > 2.0; rate /= 2.0)
+      chain += "atempo=2.0,";
+    for (; rate < 0.5; rate /= 0.5)
+      chain += "atempo=0.5,";
+    chain += "atempo=" + std::to_string(rate);
+    chain += std::string(",aformat=sample_fmts=") + sampleFormat +
+             ":sample_rates=" + sampleRate + ":channel_layouts=" + layout;
+
+    auto arguments = "time_base=1/" + sampleRate +
+                     ":sample_rate=" + sampleRate +
+                     ":sample_fmt=" + sampleFormat +
+                     ":channel_layout=" + layout;
+
+    tempoGraph = avfilter_graph_alloc();
+    if (!tempoGraph)
+      return;
+    if (avfilter_graph_create_filter(&tempoSource,
+                                     avfilter_get_by_name("abuffer"), "in",
+                                     arguments.c_str(), nullptr,
+                                     tempoGraph) < 0 ||
+        avfilter_graph_create_filter(&tempoSink,
+                                     avfilter_get_by_name("abuffersink"), "out",
+                                     nullptr, nullptr, tempoGraph) < 0 ||
+        LinkFilterGraph(tempoGraph, tempoSource, tempoSink, chain) < 0) {
+      SDL_Log("atempo graph failed: %s", chain.c_str());
+      avfilter_graph_free(&tempoGraph);
+      tempoSource = nullptr;
+      tempoSink = nullptr;
+      return;
+    }
+
+    if (!tempoFrame)
+      tempoFrame = av_frame_alloc();
+  }
+
+  // ffprobe.exe demo.mp3=>Audio: mp3, 44100 Hz, stereo, fltp, 320 kb/s
+  // ffmpeg.exe -y -i demo.mp3 -acodec pcm_s16le -f s16le -ac 2 -ar 44100
+  // demo.pcm
+  // =>demo.pcm
+  // ffplay -ar 44100 -channels 2 -f s16le -i demo.pcm
+  // =>audio
+  std::size_t AudioBufferSize = 1024 * 2 * SDL_AUDIO_BITSIZE(AUDIO_S16SYS) / 8;
+  std::unique_ptr<char[]> buffer;
+  std::size_t bufferSize = 0;
+
+  AVCodecContext *_audioCodecContext = nullptr;
+  SwrContext *audioSwresampleContext = nullptr;
+  int outputSampleRate = 44100;
+  static inline std::atomic<double> lastCallback{0}; // 最近一次回调的墙上时间
+  PacketQueue packets{gPacketPool,
+                      gOptions.live ? gLiveAudioQueueMaxBytes
+                                    : gAudioQueueMaxBytes,
+                      gAudioQueueMaxPackets};
+  AVPacket *packet = nullptr;
+  AVFrame *frame = nullptr;
+  std::size_t vernier = gInvalidVernier;
+  std::size_t bufferedBytes = 0;
+
+  // 变速不变调：abuffer -> atempo -> aformat -> abuffersink
+  AVFilterGraph *tempoGraph = nullptr;
+  AVFilterContext *tempoSource = nullptr;
+  AVFilterContext *tempoSink = nullptr;
+  AVFrame *tempoFrame = nullptr;
+  double tempo = 1.0;
+
+  std::FILE *handle = nullptr;
+};
+
+// 字幕流
+// 字幕包在独立工作线程上解码（文本/ASS 经 SDL_ttf 排版，PGS/DVB 等位图字幕
+// 按调色板展开），提前栅格化为 SDL_Surface；主线程按事件缓存纹理，显示时只做
+// 一次纹理拷贝。
+class SubtitleStream {
+public:
+  SubtitleStream(AVCodecContext *codecContext, int videoWidth, int videoHeight)
+      : codecContext(codecContext), videoWidth(videoWidth),
+        videoHeight(videoHeight) {
+    // 字体之后只在工作线程使用。
+    if (TTF_WasInit())
+      font = Foundation::OpenFont(24);
+    worker = std::thread(&SubtitleStream::Run, this);
+  }
+
+  ~SubtitleStream() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    condition.notify_all();
+    if (worker.joinable())
+      worker.join();
+
+    packets.clear();
+    for (auto &event : ready) {
+      FreeImages(event.images);
+    }
+    for (auto &[id, event] : cache) {
+      FreeImages(event.images);
+    }
+    Foundation::CloseFont(font);
+    font = nullptr;
+  }
+
+  // 队列满时返回 false，由调用方丢弃。入队与通知都在 mutex 下进行，工作线程
+  // 检查完队列、尚未等待时到达的包不会漏掉唤醒。
+  bool push(AVPacket *packet) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!packets.push(packet))
+      return false;
+    condition.notify_all();
+    return true;
+  }
+
+  // 主线程：显示 clock 时刻的字幕。新事件的纹理在进入缓存时上传一次，
+  // 过期事件的纹理随之释放。
+  void Present(SDL_Renderer *render, double clock, const SDL_Rect &videoRect) {
+    FF_TRACE_SCOPE("subtitle present");
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto &event : ready) {
+        // 时长未知的事件在下一条事件开始时结束。
+        for (auto &[id, cached] : cache) {
+          if (cached.end > event.start && cached.start < event.start &&
+              cached.openEnded)
+            cached.end = event.start;
+        }
+        auto id = nextEventId++;
+        cache.emplace(id, std::move(event));
+      }
+      ready.clear();
+    }
+
+    for (auto it = cache.begin(); it != cache.end();) {
+      auto &event = it->second;
+      if (event.end < clock) {
+        FreeImages(event.images);
+        it = cache.erase(it);
+        continue;
+      }
+
+      for (auto &image : event.images) {
+        if (!image.texture && image.surface) {
+          image.texture = SDL_CreateTextureFromSurface(render, image.surface);
+          SDL_FreeSurface(image.surface);
+          image.surface = nullptr;
+        }
+      }
+
+      if (event.start <= clock) {
+        for (auto &image : event.images) {
+          auto target = Place(image, videoRect);
+          SDL_RenderCopy(render, image.texture, nullptr, &target);
+        }
+      }
+      ++it;
+    }
+  }
+
+private:
+  struct Image {
+    SDL_Surface *surface = nullptr;
+    SDL_Texture *texture = nullptr;
+    SDL_Rect rect = {0, 0, 0, 0}; // 位图字幕在字幕画布坐标系中的位置
+    int canvasWidth = 0;          // 字幕画布尺寸，解码时确定
+    int canvasHeight = 0;
+    bool text = false;
+  };
+
+  struct Event {
+    double start = 0;
+    double end = 0;
+    bool openEnded = false;
+    std::vector<Image> images;
+  };
+
+  static void FreeImages(std::vector<Image> &images) {
+    for (auto &image : images) {
+      SDL_FreeSurface(image.surface);
+      image.surface = nullptr;
+      SDL_DestroyTexture(image.texture);
+      image.texture = nullptr;
+    }
+    images.clear();
+  }
+
+  // 位图字幕按画布到视频区域的缩放比例定位；文本字幕以原始像素大小居中放在
+  // 视频底部。
+  static SDL_Rect Place(const Image &image, const SDL_Rect &videoRect) {
+    if (!image.text && image.canvasWidth > 0 && image.canvasHeight > 0) {
+      return {videoRect.x + image.rect.x * videoRect.w / image.canvasWidth,
+              videoRect.y + image.rect.y * videoRect.h / image.canvasHeight,
+              image.rect.w * videoRect.w / image.canvasWidth,
+              image.rect.h * videoRect.h / image.canvasHeight};
+    }
+    auto w = (std::min)(image.rect.w, videoRect.w);
+    auto h = image.rect.h * w / (std::max)(image.rect.w, 1);
+    return {videoRect.x + (videoRect.w - w) / 2,
+            videoRect.y + videoRect.h - h - videoRect.h / 20, w, h};
+  }
+
+  // ASS 事件行：ReadOrder,Layer,Style,Name,MarginL,MarginR,MarginV,Effect,
+  // Text，取第 9 个字段并去掉 {\...} 覆盖标签。
+  static std::string AssToText(const char *ass) {
+    std::string line(ass ? ass : "");
+    std::size_t position = 0;
+    for (int field = 0; field < 8 && position != std::string::npos; ++field) {
+      position = line.find(',', position);
+      if (position != std::string::npos)
+        ++position;
+    }
+    if (position == std::string::npos)
+      return std::string();
+
+    std::string text;
+    for (auto i = position; i < line.size(); ++i) {
+      if (line[i] == '{') {
+        auto close = line.find('}', i);
+        if (close == std::string::npos)
+          break;
+        i = close;
+      } else if (line[i] == '\\' && i + 1 < line.size() &&
+                 (line[i + 1] == 'N' || line[i + 1] == 'n')) {
+        text += '\n';
+        ++i;
+      } else if (line[i] == '\\' && i + 1 < line.size() && line[i + 1] == 'h') {
+        text += ' ';
+        ++i;
+      } else {
+        text += line[i];
+      }
+    }
+    return text;
+  }
+
+  SDL_Surface *RenderText(const std::string &text) {
+    if (!font || text.empty())
+      return nullptr;
+    SDL_Color color = {255, 255, 255, 255};
+    return TTF_RenderUTF8_Blended_Wrapped(font, text.c_str(), color,
+                                          (std::max)(videoWidth, 640));
+  }
+
+  static SDL_Surface *RenderBitmap(const AVSubtitleRect *rect) {
+    if (rect->w <= 0 || rect->h <= 0 || !rect->data[0] || !rect->data[1])
+      return nullptr;
+    auto surface = SDL_CreateRGBSurfaceWithFormat(0, rect->w, rect->h, 32,
+                                                  SDL_PIXELFORMAT_ARGB8888);
+    if (!surface)
+      return nullptr;
+
+    auto palette = reinterpret_cast<const uint32_t *>(rect->data[1]);
+    for (int y = 0; y < rect->h; ++y) {
+      auto source = rect->data[0] + y * rect->linesize[0];
+      auto target = reinterpret_cast<uint32_t *>(
+          static_cast<uint8_t *>(surface->pixels) + y * surface->pitch);
+      for (int x = 0; x < rect->w; ++x) {
+        target[x] = source[x] < rect->nb_colors ? palette[source[x]] : 0;
+      }
+    }
+    return surface;
+  }
+
+  void Decode(AVPacket *packet) {
+    AVSubtitle subtitle;
+    std::memset(&subtitle, 0, sizeof(subtitle));
+    int gotSubtitle = 0;
+    {
+      FF_TRACE_SCOPE("avcodec_decode_subtitle2");
+      if (avcodec_decode_subtitle2(codecContext, &subtitle, &gotSubtitle,
+                                   packet) < 0 ||
+          !gotSubtitle)
+        return;
+    }
+
+    auto base = subtitle.pts != AV_NOPTS_VALUE
+                    ? subtitle.pts / static_cast<double>(AV_TIME_BASE)
+                    : packet->pts * av_q2d(codecContext->pkt_timebase);
+    Event event;
+    event.start = base + subtitle.start_display_time / 1000.0;
+    // PGS/DVB 常以空事件表示清屏，时长未知时持续到下一条事件。
+    event.openEnded = subtitle.end_display_time == 0 ||
+                      subtitle.end_display_time == UINT32_MAX;
+    event.end = event.openEnded ? std::numeric_limits<double>::max()
+                                : base + subtitle.end_display_time / 1000.0;
+
+    {
+      FF_TRACE_SCOPE("subtitle raster");
+      // 位图坐标相对字幕自身的画布（如 1080p 视频里的 720p PGS），解码器
+      // 给出画布尺寸时用它，否则认为与视频一致。PGS 在解码后才知道尺寸，
+      // 所以每个事件都重新读取。
+      auto ownCanvas = codecContext->width > 0 && codecContext->height > 0;
+      auto canvasWidth = ownCanvas ? codecContext->width : videoWidth;
+      auto canvasHeight = ownCanvas ? codecContext->height : videoHeight;
+      std::string text;
+      for (unsigned i = 0; i < subtitle.num_rects; ++i) {
+        auto rect = subtitle.rects[i];
+        if (rect->type == SUBTITLE_BITMAP) {
+          Image image;
+          image.surface = RenderBitmap(rect);
+          image.rect = {rect->x, rect->y, rect->w, rect->h};
+          image.canvasWidth = canvasWidth;
+          image.canvasHeight = canvasHeight;
+          if (image.surface)
+            event.images.push_back(image);
+        } else {
+          auto line = rect->type == SUBTITLE_ASS
+                          ? AssToText(rect->ass)
+                          : std::string(rect->text ? rect->text : "");
+          if (!line.empty())
+            text += (text.empty() ? "" : "\n") + line;
+        }
+      }
+
+      if (auto surface = RenderText(text)) {
+        Image image;
+        image.surface = surface;
+        image.rect = {0, 0, surface->w, surface->h};
+        image.text = true;
+        event.images.push_back(image);
+      }
+    }
+    avsubtitle_free(&subtitle);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ready.push_back(std::move(event));
+  }
+
+  void Run() {
+    Foundation::Trace::SetThreadName("subtitle");
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]() { return quit || packets.size() > 0; });
+        if (quit)
+          break;
+      }
+
+      while (auto packet = packets.pop()) {
+        Decode(packet);
+        gPacketPool.release(packet);
+      }
+    }
+  }
+
+  AVCodecContext *codecContext = nullptr;
+  int videoWidth = 0;
+  int videoHeight = 0;
+  TTF_Font *font = nullptr;
+
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable condition;
+  PacketQueue packets{gPacketPool, 256 * 1024, 256};
+  bool quit = false;
+
+  std::vector<Event> ready;          // 工作线程已栅格化、待主线程接收的事件
+  std::map<uint64_t, Event> cache;   // 主线程按事件缓存的纹理
+  uint64_t nextEventId = 0;
+};
+
+// 视频纹理池
+// 按 (像素格式, 宽, 高) 缓存流式纹理。码率自适应切换或拼接文件中途改变分辨率、
+// 像素格式时，新纹理在切换帧到达显示时间之前就已创建好；旧纹理保留下来，切回
+// 时直接复用，超出容量才按最久未用淘汰。只能在渲染线程使用。
+class TexturePool {
+public:
+  struct Key {
+    Uint32 format = SDL_PIXELFORMAT_UNKNOWN;
+    int width = 0;
+    int height = 0;
+
+    bool operator==(const Key &) const = default;
+  };
+
+  explicit TexturePool(SDL_Renderer *render, std::size_t capacity = 4)
+      : render(render), capacity(capacity) {
+    // 预留容量，保证 push_back 不会使 current 指针失效。
+    entries.reserve(capacity + 1);
+  }
+  ~TexturePool() {
+    for (auto &entry : entries)
+      SDL_DestroyTexture(entry.texture);
+  }
+
+  TexturePool(const TexturePool &) = delete;
+  TexturePool &operator=(const TexturePool &) = delete;
+
+  // SDL 能直接上传的像素格式，其余格式由调用方先转换为 yuv420p。
+  static Uint32 PixelFormat(int format) {
+    switch (format) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+      return SDL_PIXELFORMAT_IYUV;
+    case AV_PIX_FMT_NV12:
+      return SDL_PIXELFORMAT_NV12;
+    case AV_PIX_FMT_NV21:
+      return SDL_PIXELFORMAT_NV21;
+    default:
+      return SDL_PIXELFORMAT_UNKNOWN;
+    }
+  }
+
+  static Key KeyOf(const AVFrame *frame) {
+    auto format = PixelFormat(frame->format);
+    if (format == SDL_PIXELFORMAT_UNKNOWN)
+      format = SDL_PIXELFORMAT_IYUV;
+    return {format, frame->width, frame->height};
+  }
+
+  // 预先创建即将用到的纹理，不改变当前显示的纹理。
+  void prepare(const Key &key) { find(key); }
+
+  // 切换到 key 对应的纹理并返回，用于本帧上传。
+  SDL_Texture *acquire(const Key &key) {
+    auto entry = find(key);
+    if (!entry)
+      return nullptr;
+    if (current && !(current->key == key))
+      ++switches;
+    current = entry;
+    return entry->texture;
+  }
+
+  std::size_t size() const { return entries.size(); }
+  std::size_t switched() const { return switches; }
+
+private:
+  struct Entry {
+    Key key;
+    SDL_Texture *texture = nullptr;
+    uint64_t lastUsed = 0;
+  };
+
+  Entry *find(const Key &key) {
+    if (key.width <= 0 || key.height <= 0)
+      return nullptr;
+
+    for (auto &entry : entries) {
+      if (entry.key == key) {
+        entry.lastUsed = ++useCounter;
+        return &entry;
+      }
+    }
+
+    FF_TRACE_SCOPE("SDL_CreateTexture");
+    auto texture = SDL_CreateTexture(render, key.format,
+                                     SDL_TEXTUREACCESS_STREAMING, key.width,
+                                     key.height);
+    if (!texture) {
+      SDL_Log("create texture %dx%d failed: %s", key.width, key.height,
+              SDL_GetError());
+      return nullptr;
+    }
+
+    // 淘汰最久未用且不在显示中的纹理。
+    if (entries.size() >= capacity) {
+      auto victim = entries.end();
+      for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (&*it != current &&
+            (victim == entries.end() || it->lastUsed < victim->lastUsed))
+          victim = it;
+      }
+      if (victim != entries.end()) {
+        SDL_DestroyTexture(victim->texture);
+        *victim = {key, texture, ++useCounter};
+        return &*victim;
+      }
+    }
+
+    entries.push_back({key, texture, ++useCounter});
+    return &entries.back();
+  }
+
+  SDL_Renderer *render = nullptr;
+  std::size_t capacity = 4;
+  std::vector<Entry> entries;
+  Entry *current = nullptr;
+  uint64_t useCounter = 0;
+  std::size_t switches = 0;
+};
+
+// 解码帧共享内存导出
+// 呈现的帧复制到命名共享内存（Win32 页面文件映射）中固定数量的槽位环，旁路的
+// 分析进程无需再解码一遍。布局：RingHeader 后跟 slotCount 个槽位，每个槽位是
+// SlotHeader 加按 1 字节对齐紧密排列的图像平面。
+// 槽位用序列锁保护：写入期间序列号为奇数，读者前后两次读到相同的偶数才算完整。
+// 写者总是覆盖最旧的槽位、从不等待读者；落后超过一圈的读者直接跳到仍有效的最旧
+// 帧，错过的帧计为丢弃。每发布一帧交替置位两个手动重置事件，所有读者都会被
+// 唤醒。读者读到 published 后、开始等待前，写者若已连发两帧，所等的事件会被
+// 再次复位；这时读者最迟在下一帧发布时醒来，超时返回前也会重新检查
+// published，已发布的帧不会因此漏读。
+struct SharedFrameHeader {
+  std::atomic<uint64_t> sequence;
+  int64_t frameIndex;
+  int64_t pts;
+  int32_t timeBaseNum;
+  int32_t timeBaseDen;
+  int32_t format; // AVPixelFormat
+  int32_t width;
+  int32_t height;
+  int32_t linesize[4];
+  uint32_t offset[4]; // 各平面相对数据区起点的偏移
+  uint32_t size;      // 数据区有效字节数
+};
+
+struct SharedRingHeader {
+  static constexpr uint32_t magic = 0x4D534646; // "FFSM"
+  static constexpr uint32_t version = 1;
+  static constexpr uint64_t size = 4096; // 头部独占一页，槽位按页对齐
+
+  uint32_t magicNumber;
+  uint32_t versionNumber;
+  uint32_t slotCount;
+  uint32_t reserved;
+  uint64_t slotSize; // 每个槽位的字节数，含 SharedFrameHeader
+  std::atomic<uint64_t> published;
+  std::atomic<uint32_t> closed;
+};
+
+// 映射与事件名：Local\<name>、Local\<name>.ready0、Local\<name>.ready1
+std::wstring SharedObjectName(const std::string &name, const char *suffix) {
+  return SysMultiByteToWide("Local\\" + name + suffix, CP_UTF8);
+}
+
+class FrameExporter {
+public:
+  // 至少容纳一帧 3840x2160 yuv420p，分辨率切换后大于槽位的帧跳过并计数。
+  static constexpr int minSlotWidth = 3840;
+  static constexpr int minSlotHeight = 2160;
+
+  FrameExporter(const std::string &name, uint32_t slotCount)
+      : name(name), slotCount((std::max)(slotCount, 2u)) {
+    pending = av_frame_alloc();
+    writing = av_frame_alloc();
+  }
+  ~FrameExporter() {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [this]() { return !scheduled; });
+    }
+    av_frame_free(&pending);
+    av_frame_free(&writing);
+
+    if (ring) {
+      ring->closed.store(1, std::memory_order_release);
+      SetEvent(events[0]);
+      SetEvent(events[1]);
+      UnmapViewOfFile(ring);
+    }
+    for (auto event : events) {
+      if (event)
+        CloseHandle(event);
+    }
+    if (mapping)
+      CloseHandle(mapping);
+    SDL_Log("export %s: %llu published, %zu dropped, %zu oversized",
+            name.c_str(), static_cast<unsigned long long>(published()),
+            droppedFrames, oversizedFrames);
+  }
+
+  FrameExporter(const FrameExporter &) = delete;
+  FrameExporter &operator=(const FrameExporter &) = delete;
+
+  // 主线程：只增加一次引用计数，复制作为后台任务执行。后台任务还没取走的
+  // 上一帧直接被替换，主线程不会因此等待。
+  void push(const AVFrame *frame, AVRational timeBase) {
+    bool schedule = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!pending || !writing)
+        return;
+      if (pending->buf[0]) {
+        av_frame_unref(pending);
+        ++droppedFrames;
+      }
+      if (av_frame_ref(pending, frame) < 0)
+        return;
+      pendingTimeBase = timeBase;
+      schedule = !scheduled;
+      scheduled = true;
+    }
+    if (schedule) {
+      Foundation::gScheduler->Post(Foundation::Scheduler::Background,
+                                   [this]() { Drain(); });
+    }
+  }
+
+  // 复制一帧到下一个槽位并通知读者。只能由一个线程调用。
+  bool Write(const AVFrame *frame, AVRational timeBase) {
+    auto format = static_cast<AVPixelFormat>(frame->format);
+    auto size =
+        av_image_get_buffer_size(format, frame->width, frame->height, 1);
+    if (size <= 0 || failed)
+      return false;
+    if (!ring) {
+      // 创建失败后不再重试，避免每帧重复报错。
+      failed = !Create(static_cast<uint64_t>(size));
+      if (failed)
+        return false;
+    }
+    if (sizeof(SharedFrameHeader) + size > ring->slotSize) {
+      ++oversizedFrames;
+      return false;
+    }
+
+    FF_TRACE_SCOPE("frame export");
+    auto index = ring->published.load(std::memory_order_relaxed);
+    auto slot = Slot(index % slotCount);
+    auto data = reinterpret_cast<uint8_t *>(slot + 1);
+    auto sequence = slot->sequence.load(std::memory_order_relaxed);
+    slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->frameIndex = static_cast<int64_t>(index);
+    slot->pts = frame->best_effort_timestamp != AV_NOPTS_VALUE
+                    ? frame->best_effort_timestamp
+                    : frame->pts;
+    slot->timeBaseNum = timeBase.num;
+    slot->timeBaseDen = timeBase.den;
+    slot->format = frame->format;
+    slot->width = frame->width;
+    slot->height = frame->height;
+    slot->size = static_cast<uint32_t>(size);
+    uint8_t *planes[4] = {};
+    av_image_fill_arrays(planes, slot->linesize, data, format, frame->width,
+                         frame->height, 1);
+    for (int i = 0; i < 4; ++i)
+      slot->offset[i] = planes[i] ? static_cast<uint32_t>(planes[i] - data) : 0;
+    av_image_copy_to_buffer(data, size, frame->data, frame->linesize, format,
+                            frame->width, frame->height, 1);
+
+    slot->sequence.store(sequence + 2, std::memory_order_release);
+    ring->published.store(index + 1, std::memory_order_release);
+    ResetEvent(events[(index + 1) % 2]);
+    SetEvent(events[index % 2]);
+    return true;
+  }
+
+  uint64_t published() const {
+    return ring ? ring->published.load(std::memory_order_relaxed) : 0;
+  }
+
+private:
+  // 同一时刻最多只有一个导出任务在执行，写完待导出的帧后结束。
+  void Drain() {
+    while (true) {
+      AVRational timeBase;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!pending->buf[0]) {
+          scheduled = false;
+          condition.notify_all();
+          return;
+        }
+        av_frame_move_ref(writing, pending);
+        timeBase = pendingTimeBase;
+      }
+      Write(writing, timeBase);
+      av_frame_unref(writing);
+    }
+  }
+
+  bool Create(uint64_t frameSize) {
+    auto minimum = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, minSlotWidth,
+                                            minSlotHeight, 1);
+    auto slotSize = sizeof(SharedFrameHeader) +
+                    (std::max)(frameSize, static_cast<uint64_t>(minimum));
+    slotSize = (slotSize + SharedRingHeader::size - 1) &
+               ~(SharedRingHeader::size - 1);
+    auto total = SharedRingHeader::size + slotSize * slotCount;
+
+    mapping = CreateFileMappingW(
+        INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+        static_cast<DWORD>(total >> 32), static_cast<DWORD>(total),
+        SharedObjectName(name, "").c_str());
+    if (!mapping || GetLastError() == ERROR_ALREADY_EXISTS) {
+      SDL_Log("export %s: shared memory unavailable or in use", name.c_str());
+      return false;
+    }
+    for (int i = 0; i < 2; ++i) {
+      events[i] = CreateEventW(
+          nullptr, TRUE, FALSE,
+          SharedObjectName(name, i ? ".ready1" : ".ready0").c_str());
+      if (!events[i])
+        return false;
+    }
+
+    auto view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, total);
+    if (!view)
+      return false;
+    ring = new (view) SharedRingHeader{SharedRingHeader::magic,
+                                       SharedRingHeader::version,
+                                       slotCount,
+                                       0,
+                                       slotSize,
+                                       {0},
+                                       {0}};
+    for (uint32_t i = 0; i < slotCount; ++i)
+      new (Slot(i)) SharedFrameHeader{};
+    SDL_Log("export %s: %u slots of %llu bytes", name.c_str(), slotCount,
+            static_cast<unsigned long long>(slotSize));
+    return true;
+  }
+
+  SharedFrameHeader *Slot(uint64_t index) const {
+    auto base = reinterpret_cast<uint8_t *>(ring) + SharedRingHeader::size;
+    return reinterpret_cast<SharedFrameHeader *>(base + index * ring->slotSize);
+  }
+
+  std::string name;
+  uint32_t slotCount = 4;
+  HANDLE mapping = nullptr;
+  HANDLE events[2] = {nullptr, nullptr};
+  SharedRingHeader *ring = nullptr;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  AVFrame *pending = nullptr;
+  AVFrame *writing = nullptr; // 只由导出任务使用
+  AVRational pendingTimeBase = {1, 1};
+  bool scheduled = false;
+  bool failed = false;
+  std::size_t droppedFrames = 0;
+  std::size_t oversizedFrames = 0;
+};
+
+// 共享内存帧读者，参考实现：外部分析进程照此读取即可。
+class FrameReader {
+public:
+  struct Frame {
+    int64_t frameIndex = 0;
+    int64_t pts = 0;
+    AVRational timeBase = {1, 1};
+    AVPixelFormat format = AV_PIX_FMT_NONE;
+    int width = 0;
+    int height = 0;
+    int linesize[4] = {};
+    uint32_t offset[4] = {};
+    std::vector<uint8_t> data;
+  };
+
+  explicit FrameReader(const std::string &name) : name(name) {}
+  ~FrameReader() { Close(); }
+
+  FrameReader(const FrameReader &) = delete;
+  FrameReader &operator=(const FrameReader &) = delete;
+
+  // 写者在第一帧时才创建共享内存，打开失败时调用方可稍后重试。
+  bool Open() {
+    if (ring)
+      return true;
+    mapping = OpenFileMappingW(FILE_MAP_READ, FALSE,
+                               SharedObjectName(name, "").c_str());
+    for (int i = 0; mapping && i < 2; ++i) {
+      events[i] = OpenEventW(
+          SYNCHRONIZE, FALSE,
+          SharedObjectName(name, i ? ".ready1" : ".ready0").c_str());
+    }
+    if (!mapping || !events[0] || !events[1]) {
+      Close();
+      return false;
+    }
+
+    ring = static_cast<SharedRingHeader *>(
+        MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!ring || ring->magicNumber != SharedRingHeader::magic ||
+        ring->versionNumber != SharedRingHeader::version) {
+      SDL_Log("reader %s: incompatible shared memory", name.c_str());
+      Close();
+      return false;
+    }
+    // 从最新一帧开始读。
+    auto published = ring->published.load(std::memory_order_acquire);
+    next = published ? published - 1 : 0;
+    return true;
+  }
+
+  // 读下一帧；超时或写者已关闭时返回 false。
+  bool Next(Frame &frame, DWORD timeout) {
+    if (!ring)
+      return false;
+
+    while (true) {
+      auto published = ring->published.load(std::memory_order_acquire);
+      if (next >= published) {
+        if (ring->closed.load(std::memory_order_acquire))
+          return false;
+        // 事件只是提示，是否有新帧以 published 为准。
+        if (WaitForSingleObject(events[published % 2], timeout) !=
+                WAIT_OBJECT_0 &&
+            ring->published.load(std::memory_order_acquire) <= next)
+          return false;
+        continue;
+      }
+
+      // 落后超过一圈：更早的槽位已被覆盖，跳到仍有效的最旧帧。
+      auto oldest = published > ring->slotCount - 1
+                        ? published - (ring->slotCount - 1)
+                        : 0;
+      if (next < oldest) {
+        droppedFrames += oldest - next;
+        next = oldest;
+      }
+
+      if (Copy(next, frame)) {
+        ++next;
+        ++receivedFrames;
+        return true;
+      }
+      // 读取期间被写者覆盖。
+      ++droppedFrames;
+      ++next;
+    }
+  }
+
+  uint64_t received() const { return receivedFrames; }
+  uint64_t dropped() const { return droppedFrames; }
+
+private:
+  void Close() {
+    if (ring)
+      UnmapViewOfFile(ring);
+    ring = nullptr;
+    for (auto &event : events) {
+      if (event)
+        CloseHandle(event);
+      event = nullptr;
+    }
+    if (mapping)
+      CloseHandle(mapping);
+    mapping = nullptr;
+  }
+
+  bool Copy(uint64_t index, Frame &frame) {
+    auto base =
+        reinterpret_cast<const uint8_t *>(ring) + SharedRingHeader::size;
+    auto slot = reinterpret_cast<const SharedFrameHeader *>(
+        base + (index % ring->slotCount) * ring->slotSize);
+    auto before = slot->sequence.load(std::memory_order_acquire);
+    if (before & 1)
+      return false;
+
+    frame.frameIndex = slot->frameIndex;
+    frame.pts = slot->pts;
+    frame.timeBase = av_make_q(slot->timeBaseNum, slot->timeBaseDen);
+    frame.format = static_cast<AVPixelFormat>(slot->format);
+    frame.width = slot->width;
+    frame.height = slot->height;
+    std::memcpy(frame.linesize, slot->linesize, sizeof(frame.linesize));
+    std::memcpy(frame.offset, slot->offset, sizeof(frame.offset));
+    auto size = (std::min)(static_cast<uint64_t>(slot->size),
+                           ring->slotSize - sizeof(SharedFrameHeader));
+    frame.data.resize(size);
+    std::memcpy(frame.data.data(), slot + 1, size);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    auto after = slot->sequence.load(std::memory_order_relaxed);
+    return before == after && frame.frameIndex == static_cast<int64_t>(index);
+  }
+
+  std::string name;
+  HANDLE mapping = nullptr;
+  HANDLE events[2] = {nullptr, nullptr};
+  const SharedRingHeader *ring = nullptr;
+  uint64_t next = 0;
+  uint64_t receivedFrames = 0;
+  uint64_t droppedFrames = 0;
+};
+
+// 退出时置位：后台打开中的 VideoStream 还没有析构可设 quit，靠它中断阻塞在
+// avformat_open_input/avformat_find_stream_info 里的读操作（无发送方的
+// udp、命名管道、stdin）。
+std::atomic<bool> gAbortIo{false};
+
+class VideoStream {
+public:
+  // 音频与字幕管线的预热结果：在后台线程创建，由主线程安装。
+  struct Warmup {
+    std::unique_ptr<AudioStream> audio;
+    std::unique_ptr<SubtitleStream> subtitles;
+  };
+
+  // 构造只打开容器与视频解码器，可在后台线程执行；音频和字幕在首帧显示后
+  // 由 WarmUp/Install 补齐。
+  VideoStream() {
+    std::filesystem::path path(wil::GetModuleFileNameW<std::wstring>(nullptr));
+    path = path.parent_path().append("demo.mp4");
+
+    [&]() {
+      std::string url = gOptions.input == "-" ? "pipe:0" : gOptions.input;
+      if (url.empty()) {
+        if (!std::filesystem::exists(path))
+          return;
+        url = SysWideToMultiByte(path.c_str(), CP_ACP);
+      }
+
+      // 直播源：缩小探测量、关闭输入缓冲，尽快出第一帧。
+      AVDictionary *options = nullptr;
+      if (gOptions.live) {
+        av_dict_set(&options, "fflags", "nobuffer", 0);
+        av_dict_set_int(&options, "probesize", 32 * 1024, 0);
+        av_dict_set_int(&options, "analyzeduration", 200 * 1000, 0);
+      }
+
+      // 中断回调让阻塞中的读操作在析构时及时返回。
+      formatContext = avformat_alloc_context();
+      if (!formatContext)
+        return;
+      formatContext->interrupt_callback.callback = &VideoStream::Interrupt;
+      formatContext->interrupt_callback.opaque = this;
+
+      // Open input file, result should be zero.
+      auto result =
+          avformat_open_input(&formatContext, url.c_str(), nullptr, &options);
+      av_dict_free(&options);
+      if (result != 0)
+        return;
+
+      // 管道和网络流的容器头不一定带完整参数，探测量受上面的选项限制。
+      result = avformat_find_stream_info(formatContext, nullptr);
+      if (result < 0)
+        return;
+
+      // Find video stream
+      videoStream = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1,
+                                        -1, nullptr, 0);
+      if (videoStream == -1)
+        return;
+
+      // Find video decoder and initialize a context.
+      auto videoCodecParameters = formatContext->streams[videoStream]->codecpar;
+      auto videoCodec = avcodec_find_decoder(videoCodecParameters->codec_id);
+      if (videoCodec == nullptr)
+        return;
+      videoCodecContext = avcodec_alloc_context3(videoCodec);
+      result = avcodec_parameters_to_context(videoCodecContext,
+                                             videoCodecParameters);
+      if (result != 0)
+        return;
+
+      // 直播低延迟解码：帧级多线程会引入与线程数相当的帧延迟，
+      // 改用 slice 多线程。
+      if (gOptions.live) {
+        videoCodecContext->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        videoCodecContext->flags2 |= AV_CODEC_FLAG2_FAST;
+        videoCodecContext->thread_type = FF_THREAD_SLICE;
+      }
+
+      // open decoder.
+      result = avcodec_open2(videoCodecContext, videoCodec, nullptr);
+      if (result < 0)
+        return;
+
+      // 滤镜图按初始分辨率配置，启用滤镜时不降到 lowres。
+      if (videoCodec->max_lowres > 0 && gOptions.videoFilter.empty())
+        degradation = DecodeDegradation(DecodeDegradation::LowResolution);
+
+      // Find audio and subtitle stream, decoders are opened by WarmUp.
+      for (unsigned int i = 0; i < formatContext->nb_streams; ++i) {
+        if (formatContext->streams[i]->codecpar->codec_type ==
+            AVMEDIA_TYPE_AUDIO)
+          audioStreams.push_back(static_cast<int>(i));
+      }
+      audioStream = SelectStream(AVMEDIA_TYPE_AUDIO, gOptions.audioTrack);
+      subtitleStream =
+          SelectStream(AVMEDIA_TYPE_SUBTITLE, gOptions.subtitleTrack);
+      ApplyDiscard();
+
+      // Allocate video frame.
+      frame = av_frame_alloc();
+
+      _width = videoCodecContext->width;
+      _height = videoCodecContext->height;
+
+      auto frameRate = av_guess_frame_rate(
+          formatContext, formatContext->streams[videoStream], nullptr);
+      if (frameRate.num > 0 && frameRate.den > 0)
+        frameDuration = av_q2d(av_inv_q(frameRate));
+
+      if (!gOptions.videoFilter.empty()) {
+        filter = std::make_unique<VideoFilter>(
+            videoCodecContext, formatContext->streams[videoStream],
+            gOptions.videoFilter);
+        if (filter->valid()) {
+          filteredFrame = av_frame_alloc();
+          _width = filter->width();
+          _height = filter->height();
+        } else {
+          filter.reset();
+        }
+      }
+
+      if (!gOptions.exportName.empty()) {
+        exporter = std::make_unique<FrameExporter>(gOptions.exportName,
+                                                   gOptions.exportSlots);
+      }
+
+      if (gOptions.live) {
+        // 队列只容纳两倍目标延迟的帧：再多积压就超出目标，丢包追赶更快。
+        auto packets = static_cast<std::size_t>(
+            ceil(gOptions.latencyTarget * 2 / frameDuration));
+        videoPackets = std::make_unique<PacketQueue>(
+            gPacketPool, gLiveVideoQueueMaxBytes,
+            (std::max)(packets, std::size_t(4)));
+
+        auto stream = formatContext->streams[videoStream];
+        auto wrapPeriod = stream->pts_wrap_bits > 0 &&
+                                  stream->pts_wrap_bits < 63
+                              ? ldexp(av_q2d(stream->time_base),
+                                      stream->pts_wrap_bits)
+                              : 0.0;
+        latencyController = std::make_unique<LatencyController>(
+            gOptions.latencyTarget, gOptions.wallclockPts, wrapPeriod);
+        demuxer = std::thread(&VideoStream::Demux, this);
+      }
+    }();
+  }
+
+  ~VideoStream() {
+    quit = true;
+    if (demuxer.joinable())
+      demuxer.join();
+    if (videoPackets)
+      videoPackets->clear();
+
+    gFFmpegAudioStream.reset();
+
+    subtitles.reset();
+    if (subtitleCodecContext)
+      avcodec_free_context(&subtitleCodecContext);
+
+    filter.reset();
+    if (filteredFrame)
+      av_frame_free(&filteredFrame);
+    filteredFrame = nullptr;
+
+    if (frame)
+      av_frame_free(&frame);
+    frame = nullptr;
+
+    if (convertedFrame)
+      av_frame_free(&convertedFrame);
+    sws_freeContext(convertContext);
+    convertContext = nullptr;
+
+    gPacketPool.release(packet);
+    packet = nullptr;
+
+    gPacketPool.release(pendingAudioPacket);
+    pendingAudioPacket = nullptr;
+
+    if (videoCodecContext)
+      avcodec_close(videoCodecContext);
+    videoCodecContext = nullptr;
+
+    if (audioCodecContext) {
+      avcodec_close(audioCodecContext);
+    }
+    audioCodecContext = nullptr;
+
+    if (formatContext)
+      avformat_close_input(&formatContext);
+    formatContext = nullptr;
+  }
+
+  int width() const { return this->_width; }
+  int height() const { return this->_height; }
+  bool ready() const { return frame != nullptr; }
+
+  // 后台线程：打开音频解码器与音频设备、字幕解码器与字幕线程。
+  Warmup WarmUp() {
+    Warmup warmup;
+    if (!ready())
+      return warmup;
+
+    if (audioStream >= 0 && SDL_WasInit(SDL_INIT_AUDIO)) {
+      audioCodecContext =
+          OpenAudioDecoder(formatContext->streams[audioStream]->codecpar);
+      if (audioCodecContext)
+        warmup.audio = std::make_unique<AudioStream>(audioCodecContext);
+      // 没有可用的音频设备时不安装音频流，音频包随之丢弃，视频照常播放。
+      if (warmup.audio && !AudioStream::playing()) {
+        SDL_Log("audio device unavailable, playing without audio");
+        warmup.audio.reset();
+      }
+    }
+
+    warmup.subtitles = OpenSubtitles();
+    return warmup;
+  }
+
+  // 主线程：安装预热结果。音频回调与直播解复用线程同时会读取这些对象。
+  void Install(Warmup warmup) {
+    std::lock_guard<std::mutex> lock(routingMutex);
+    SDL_LockAudio();
+    gFFmpegAudioStream = std::move(warmup.audio);
+    SDL_UnlockAudio();
+    subtitles = std::move(warmup.subtitles);
+  }
+
+  // 主线程：切换到下一条音轨，不重新打开文件。新音轨的编码参数与当前解码器
+  // 一致时沿用解码器上下文，只清空其内部状态；否则先在锁外打开新解码器。
+  void SwitchAudioTrack() {
+    if (audioStreams.size() < 2 || !gFFmpegAudioStream)
+      return;
+
+    auto current =
+        std::find(audioStreams.begin(), audioStreams.end(), audioStream);
+    auto next = current == audioStreams.end() ||
+                        current + 1 == audioStreams.end()
+                    ? audioStreams.front()
+                    : *(current + 1);
+    auto parameters = formatContext->streams[next]->codecpar;
+
+    auto context = audioCodecContext;
+    if (!SameAudioCodec(context, parameters)) {
+      context = OpenAudioDecoder(parameters);
+      if (!context)
+        return;
+    }
+
+    auto previous = audioCodecContext;
+    {
+      std::lock_guard<std::mutex> lock(routingMutex);
+      SDL_LockAudio();
+      gFFmpegAudioStream->Switch(context);
+      SDL_UnlockAudio();
+      gPacketPool.release(pendingAudioPacket);
+      pendingAudioPacket = nullptr;
+      audioStream = next;
+      audioCodecContext = context;
+      ApplyDiscard();
+    }
+    if (previous != context)
+      avcodec_free_context(&previous);
+    SDL_Log("audio track: %s", audioTrack().c_str());
+  }
+
+  // 当前音轨描述，例如 "2/8 eng"；没有音频时为空。
+  std::string audioTrack() const {
+    auto current =
+        std::find(audioStreams.begin(), audioStreams.end(), audioStream);
+    if (current == audioStreams.end())
+      return {};
+
+    auto description =
+        std::to_string(current - audioStreams.begin() + 1) + "/" +
+        std::to_string(audioStreams.size());
+    auto language = av_dict_get(formatContext->streams[audioStream]->metadata,
+                                "language", nullptr, 0);
+    if (language)
+      description += std::string(" ") + language->value;
+    return description;
+  }
+
+  bool HasFrame() {
+    if (!packet) {
+      // 先读结束标志再取包：直播解复用线程在最后一个包入队之后才置位。
+      auto ended = inputEnded.load();
+      packet = ReadVideoPacket();
+      if (!packet)
+        return ended && DrainDecoder();
+      // 重新打开解码器后从关键帧开始送包。
+      if (waitKeyframe && !(packet->flags & AV_PKT_FLAG_KEY)) {
+        gPacketPool.release(packet);
+        packet = nullptr;
+        return HasFrame();
+      }
+      waitKeyframe = false;
+      FF_TRACE_SCOPE("video avcodec_send_packet");
+      auto begin = SDL_GetPerformanceCounter();
+      avcodec_send_packet(videoCodecContext, packet);
+      decodeCounter += SDL_GetPerformanceCounter() - begin;
+    }
+
+    int received = 0;
+    {
+      FF_TRACE_SCOPE("video avcodec_receive_frame");
+      auto begin = SDL_GetPerformanceCounter();
+      received = avcodec_receive_frame(videoCodecContext, frame);
+      decodeCounter += SDL_GetPerformanceCounter() - begin;
+    }
+    if (received != 0) {
+      gPacketPool.release(packet);
+      packet = nullptr;
+      return HasFrame();
+    }
+    ++decodedFrames;
+    return true;
+  }
+
+  // 输入结束后冲刷解码器，取出重排与帧级多线程缓存的最后几帧。
+  bool DrainDecoder() {
+    if (decoderDrained)
+      return false;
+    if (!decoderFlushed) {
+      avcodec_send_packet(videoCodecContext, nullptr);
+      decoderFlushed = true;
+    }
+    auto received = avcodec_receive_frame(videoCodecContext, frame);
+    if (received == 0) {
+      ++decodedFrames;
+      return true;
+    }
+    if (received == AVERROR_EOF)
+      decoderDrained = true;
+    return false;
+  }
+
+  // 按播放时钟取帧：未到显示时间的帧保留到下一次 Paint，已过期的帧直接丢弃、
+  // 不上传纹理。返回本次上传的纹理，分辨率或格式变化时纹理随之切换。
+  SDL_Texture *Read(TexturePool &textures) {
+    if (!ready())
+      return nullptr;
+
+    ApplyDecodeSettings();
+
+    // 单次 Paint 最多追赶的帧数，避免长时间卡顿后阻塞渲染。
+    constexpr int maxDroppedFramesPerRead = 8;
+    for (int dropped = 0;; ++dropped) {
+      if (!frameReady) {
+        if (!NextFrame())
+          return nullptr;
+        // 只计 send/receive 的耗时，解复用 I/O 与滤镜交接不算 CPU 压力；
+        // 启用滤镜时一次可能解出多帧，取平均。
+        auto decodeSeconds = decodeCounter * 1.0 /
+                             SDL_GetPerformanceFrequency() /
+                             (std::max)(decodedFrames, std::size_t(1));
+        decodeCounter = 0;
+        decodedFrames = 0;
+        if (degradation.OnFrame(decodeSeconds,
+                                frameDuration / gPlaybackClock.rate()))
+          ApplyDecodeSettings();
+        frameReady = true;
+        frameTime = FrameTime();
+        // 帧等待显示期间就准备好对应的纹理，切换帧到来时不再分配。
+        textures.prepare(TexturePool::KeyOf(filter ? filteredFrame : frame));
+
+        // 节奏只在新帧到来时重新锚定，同一帧等待期间的计划 vsync 不变。
+        if (!gPlaybackClock.anchored())
+          gPlaybackClock.anchor(frameTime);
+        gPresentation.Reanchor(frameTime);
+        frameTarget = gPresentation.TargetVsync(frameTime);
+      }
+
+      // 帧排在计划的 vsync 上：未轮到时继续显示上一帧；它的显示时段（下一帧
+      // 的计划 vsync 之前）已经过去则丢弃。
+      auto upcoming = gPresentation.UpcomingVsync();
+      if (frameTarget > upcoming)
+        return nullptr;
+      if (gPresentation.TargetVsync(frameTime + frameDuration) > upcoming ||
+          dropped >= maxDroppedFramesPerRead)
+        break;
+
+      // 计划的 vsync 已经过去才算过期；帧率高于刷新率时按节奏跳过的帧不算。
+      frameReady = false;
+      ++droppedFrames;
+      if (frameTarget < upcoming)
+        degradation.OnLate();
+    }
+    frameReady = false;
+
+    if (latencyController)
+      latencyController->OnPresent(frameTime);
+
+    auto output = filter ? filteredFrame : frame;
+    auto texture = textures.acquire(TexturePool::KeyOf(output));
+    if (!texture)
+      return nullptr;
+    _width = output->width;
+    _height = output->height;
+
+    FF_TRACE_SCOPE("texture upload");
+    if (!Upload(texture, output))
+      return nullptr;
+    gPresentation.Queue(frameTarget);
+
+    if (exporter) {
+      exporter->push(output, filter ? filter->time_base()
+                                    : formatContext->streams[videoStream]
+                                          ->time_base);
+    }
+    return texture;
+  }
+
+  std::size_t dropped() const { return droppedFrames; }
+
+  void PresentSubtitles(SDL_Renderer *render, const SDL_Rect &videoRect) {
+    if (subtitles && gPlaybackClock.anchored())
+      subtitles->Present(render, gPlaybackClock.now(), videoRect);
+  }
+
+  std::string cadence() const {
+    return gPresentation.Describe(frameDuration);
+  }
+
+  const char *degradationLevel() const {
+    return DecodeDegradation::Name(degradation.level());
+  }
+
+  // 直播模式下的平滑延迟（秒），非直播或尚无数据时为负数。
+  double latency() const {
+    return latencyController ? latencyController->latency() : -1;
+  }
+  double endToEndLatency() const {
+    return latencyController ? latencyController->endToEndLatency() : -1;
+  }
+
+private:
+  // 按选项选择某类流：空为自动选择，none 为不使用，数字为该类流中的序号，
+  // 其他按语言标签匹配；找不到时回退到自动选择。
+  int SelectStream(AVMediaType type, const std::string &choice) {
+    auto best = av_find_best_stream(formatContext, type, -1, videoStream,
+                                    nullptr, 0);
+    if (choice.empty())
+      return best < 0 ? -1 : best;
+    if (choice == "none")
+      return -1;
+
+    auto numeric = std::all_of(choice.begin(), choice.end(),
+                               [](char c) { return c >= '0' && c <= '9'; });
+    auto ordinal = numeric ? std::atoi(choice.c_str()) : -1;
+    for (unsigned int i = 0, n = 0; i < formatContext->nb_streams; ++i) {
+      auto stream = formatContext->streams[i];
+      if (stream->codecpar->codec_type != type)
+        continue;
+      if (numeric) {
+        if (n++ == static_cast<unsigned int>(ordinal))
+          return static_cast<int>(i);
+        continue;
+      }
+      auto language = av_dict_get(stream->metadata, "language", nullptr, 0);
+      if (language && choice == language->value)
+        return static_cast<int>(i);
+    }
+    SDL_Log("track %s not found, using default", choice.c_str());
+    return best < 0 ? -1 : best;
+  }
+
+  // 未选中的流在解复用层直接丢弃，多音轨文件不再读取和分发无用的包。
+  // 直播解复用线程运行时，av_read_frame 在该线程上读取 discard，改由它在两次
+  // 读取之间应用。
+  void ApplyDiscard() {
+    if (demuxer.joinable()) {
+      discardChanged = true;
+      return;
+    }
+    WriteDiscard();
+  }
+
+  // 调用方需保证 av_read_frame 不在并发执行。
+  void WriteDiscard() {
+    for (unsigned int i = 0; i < formatContext->nb_streams; ++i) {
+      auto index = static_cast<int>(i);
+      auto used = index == videoStream || index == audioStream ||
+                  index == subtitleStream;
+      formatContext->streams[i]->discard =
+          used ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+  }
+
+  static AVCodecContext *OpenAudioDecoder(const AVCodecParameters *parameters) {
+    auto codec = avcodec_find_decoder(parameters->codec_id);
+    if (!codec)
+      return nullptr;
+    auto context = avcodec_alloc_context3(codec);
+    if (!context || avcodec_parameters_to_context(context, parameters) != 0 ||
+        avcodec_open2(context, codec, nullptr) != 0) {
+      avcodec_free_context(&context);
+      return nullptr;
+    }
+    return context;
+  }
+
+  // 编码器、采样参数与 extradata 都一致时，解码器上下文可以直接复用。
+  static bool SameAudioCodec(const AVCodecContext *context,
+                             const AVCodecParameters *parameters) {
+    return context && context->codec_id == parameters->codec_id &&
+           context->sample_rate == parameters->sample_rate &&
+           av_channel_layout_compare(&context->ch_layout,
+                                     &parameters->ch_layout) == 0 &&
+           context->extradata_size == parameters->extradata_size &&
+           (context->extradata_size == 0 ||
+            std::memcmp(context->extradata, parameters->extradata,
+                        context->extradata_size) == 0);
+  }
+
+  std::unique_ptr<SubtitleStream> OpenSubtitles() {
+    if (subtitleStream < 0)
+      return nullptr;
+
+    auto stream = formatContext->streams[subtitleStream];
+    auto codec = avcodec_find_decoder(stream->codecpar->codec_id);
+    if (!codec)
+      return nullptr;
+    subtitleCodecContext = avcodec_alloc_context3(codec);
+    if (!subtitleCodecContext ||
+        avcodec_parameters_to_context(subtitleCodecContext, stream->codecpar) <
+            0)
+      return nullptr;
+    subtitleCodecContext->pkt_timebase = stream->time_base;
+    if (avcodec_open2(subtitleCodecContext, codec, nullptr) < 0)
+      return nullptr;
+
+    // 视频解码器可能被降级重新打开，这里只读不变的流参数。
+    auto video = formatContext->streams[videoStream]->codecpar;
+    return std::make_unique<SubtitleStream>(subtitleCodecContext, video->width,
+                                            video->height);
+  }
+
+  // SDL 不支持的像素格式（10bit、422、RGB 等）先转换为 yuv420p。
+  bool Upload(SDL_Texture *texture, const AVFrame *output) {
+    switch (TexturePool::PixelFormat(output->format)) {
+    case SDL_PIXELFORMAT_IYUV:
+      return SDL_UpdateYUVTexture(texture, nullptr, output->data[0],
+                                  output->linesize[0], output->data[1],
+                                  output->linesize[1], output->data[2],
+                                  output->linesize[2]) == 0;
+    case SDL_PIXELFORMAT_NV12:
+    case SDL_PIXELFORMAT_NV21:
+      return SDL_UpdateNVTexture(texture, nullptr, output->data[0],
+                                 output->linesize[0], output->data[1],
+                                 output->linesize[1]) == 0;
+    default:
+      break;
+    }
+
+    if (!convertedFrame)
+      convertedFrame = av_frame_alloc();
+    if (convertedFrame->width != output->width ||
+        convertedFrame->height != output->height) {
+      av_frame_unref(convertedFrame);
+      convertedFrame->format = AV_PIX_FMT_YUV420P;
+      convertedFrame->width = output->width;
+      convertedFrame->height = output->height;
+      if (av_frame_get_buffer(convertedFrame, 0) < 0) {
+        av_frame_unref(convertedFrame);
+        return false;
+      }
+    }
+
+    convertContext = sws_getCachedContext(
+        convertContext, output->width, output->height,
+        static_cast<AVPixelFormat>(output->format), output->width,
+        output->height, AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr, nullptr,
+        nullptr);
+    if (!convertContext)
+      return false;
+    sws_scale(convertContext, output->data, output->linesize, 0,
+              output->height, convertedFrame->data, convertedFrame->linesize);
+    return SDL_UpdateYUVTexture(
+               texture, nullptr, convertedFrame->data[0],
+               convertedFrame->linesize[0], convertedFrame->data[1],
+               convertedFrame->linesize[1], convertedFrame->data[2],
+               convertedFrame->linesize[2]) == 0;
+  }
+
+  // 非音视频包：字幕交给字幕线程，其余直接回收。
+  void DispatchPacket(AVPacket *packet) {
+    if (subtitles && packet->stream_index == subtitleStream &&
+        subtitles->push(packet))
+      return;
+    gPacketPool.release(packet);
+  }
+
+  static int Interrupt(void *opaque) {
+    return gAbortIo.load() || static_cast<VideoStream *>(opaque)->quit.load()
+               ? 1
+               : 0;
+  }
+
+  // 取下一个视频包，途中读到的音频包交给音频队列。直播模式下由解复用线程读取，
+  // 这里只从队列取，不阻塞 Paint。
+  AVPacket *ReadVideoPacket() {
+    if (gOptions.live)
+      return videoPackets->pop();
+
+    while (true) {
+      // 音频队列已满：回调正在消费时等它腾出空间，内存占用因此有界；回调
+      // 停止时丢弃最旧的音频包，视频照常解码。
+      if (pendingAudioPacket) {
+        if (!gFFmpegAudioStream->push(pendingAudioPacket)) {
+          if (AudioStream::consuming())
+            return nullptr;
+          gFFmpegAudioStream->pushDroppingOldest(pendingAudioPacket);
+        }
+        pendingAudioPacket = nullptr;
+      }
+
+      auto packet = gPacketPool.acquire();
+      if (!packet)
+        return nullptr;
+      int readResult = 0;
+      {
+        FF_TRACE_SCOPE("av_read_frame");
+        readResult = av_read_frame(formatContext, packet);
+      }
+      if (readResult < 0) {
+        gPacketPool.release(packet);
+        if (readResult == AVERROR_EOF)
+          inputEnded = true;
+        return nullptr;
+      }
+      if (packet->stream_index == videoStream)
+        return packet;
+
+      if (gFFmpegAudioStream && packet->stream_index == audioStream) {
+        if (!gFFmpegAudioStream->push(packet))
+          pendingAudioPacket = packet;
+      } else {
+        DispatchPacket(packet);
+      }
+    }
+  }
+
+  // 直播解复用线程：持续读取，队列满时丢弃而不是停止读取，避免源端积压。
+  // 视频包一旦丢弃，其后的包都引用了缺失的帧，一直丢到下一个关键帧，
+  // 解码器不会输出花屏。
+  void Demux() {
+    Foundation::Trace::SetThreadName("demux");
+    auto timeBase = formatContext->streams[videoStream]->time_base;
+    bool awaitingKeyframe = false;
+    while (!quit) {
+      if (discardChanged.exchange(false)) {
+        std::lock_guard<std::mutex> lock(routingMutex);
+        WriteDiscard();
+      }
+
+      auto packet = gPacketPool.acquire();
+      if (!packet)
+        break;
+
+      int readResult = 0;
+      {
+        FF_TRACE_SCOPE("av_read_frame");
+        readResult = av_read_frame(formatContext, packet);
+      }
+      if (readResult < 0) {
+        gPacketPool.release(packet);
+        if (readResult == AVERROR(EAGAIN)) {
+          SDL_Delay(1);
+          continue;
+        }
+        if (!quit)
+          inputEnded = true;
+        break;
+      }
+
+      std::lock_guard<std::mutex> lock(routingMutex);
+      bool queued = false;
+      if (packet->stream_index == videoStream) {
+        if (packet->pts != AV_NOPTS_VALUE)
+          latencyController->OnPacket(packet->pts * av_q2d(timeBase));
+        if (packet->flags & AV_PKT_FLAG_KEY)
+          awaitingKeyframe = false;
+        queued = !awaitingKeyframe && videoPackets->push(packet);
+        if (!queued)
+          awaitingKeyframe = true;
+      } else if (gFFmpegAudioStream && packet->stream_index == audioStream) {
+        queued = gFFmpegAudioStream->push(packet);
+      } else {
+        DispatchPacket(packet);
+        queued = true;
+      }
+      if (!queued)
+        gPacketPool.release(packet);
+    }
+  }
+
+  // 启用滤镜时，解码帧交给滤镜线程，本次只取已处理完的帧，不等待滤镜。
+  bool NextFrame() {
+    if (!filter)
+      return HasFrame();
+
+    while (filter->writable() && HasFrame()) {
+      frame->pts = frame->best_effort_timestamp;
+      filter->push(frame);
+    }
+    if (decoderDrained && !filterFinished) {
+      filter->finish();
+      filterFinished = true;
+    }
+    return filter->pop(filteredFrame);
+  }
+
+  double FrameTime() {
+    if (filter) {
+      if (filteredFrame->pts == AV_NOPTS_VALUE)
+        return frameTime + frameDuration;
+      return filteredFrame->pts * av_q2d(filter->time_base());
+    }
+
+    auto timestamp = frame->best_effort_timestamp;
+    if (timestamp == AV_NOPTS_VALUE)
+      return frameTime + frameDuration;
+    return timestamp * av_q2d(formatContext->streams[videoStream]->time_base);
+  }
+
+  // 高倍速时跳过非参考帧的解码，4x 播放不需要 4 倍解码开销；CPU 不足时按降级
+  // 级别放宽解码质量。
+  void ApplyDecodeSettings() {
+    using Level = DecodeDegradation::Level;
+    auto rate = gPlaybackClock.rate();
+    auto level = degradation.level();
+    if ((rate == appliedRate && level == appliedLevel) || !videoCodecContext)
+      return;
+
+    auto lowres = level >= Level::LowResolution;
+    if (lowres != (appliedLevel >= Level::LowResolution))
+      ReopenVideoDecoder(lowres ? 1 : 0);
+    appliedRate = rate;
+    appliedLevel = level;
+
+    videoCodecContext->skip_loop_filter =
+        level >= Level::SkipLoopFilter ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+    videoCodecContext->skip_idct =
+        level >= Level::SkipIdct ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    videoCodecContext->skip_frame =
+        rate >= 2.0 || level >= Level::SkipNonReference ? AVDISCARD_NONREF
+                                                        : AVDISCARD_DEFAULT;
+  }
+
+  // lowres 只在打开解码器时生效：换用新的解码器上下文，从下一个关键帧继续。
+  // 输出分辨率随之变化，由 TexturePool 切换纹理。
+  void ReopenVideoDecoder(int lowres) {
+    auto codec = videoCodecContext->codec;
+    auto context = avcodec_alloc_context3(codec);
+    if (!context ||
+        avcodec_parameters_to_context(
+            context, formatContext->streams[videoStream]->codecpar) != 0) {
+      avcodec_free_context(&context);
+      return;
+    }
+    context->flags = videoCodecContext->flags;
+    context->flags2 = videoCodecContext->flags2;
+    context->thread_type = videoCodecContext->thread_type;
+    context->lowres = lowres;
+    if (avcodec_open2(context, codec, nullptr) < 0) {
+      avcodec_free_context(&context);
+      return;
+    }
+
+    avcodec_free_context(&videoCodecContext);
+    videoCodecContext = context;
+    gPacketPool.release(packet);
+    packet = nullptr;
+    waitKeyframe = true;
+    decoderFlushed = false;
+  }
+
+  AVFormatContext *formatContext = nullptr;
+  AVCodecContext *videoCodecContext = nullptr;
+  AVCodecContext *audioCodecContext = nullptr;
+  AVFrame *frame = nullptr;
+  int _width = 0;
+  int _height = 0;
+  int videoStream = -1;
+  int audioStream = -1;
+  AVPacket *packet = nullptr;
+  AVPacket *pendingAudioPacket = nullptr;
+  std::unique_ptr<VideoFilter> filter;
+  AVFrame *filteredFrame = nullptr;
+  AVFrame *convertedFrame = nullptr;
+  SwsContext *convertContext = nullptr;
+  bool frameReady = false;
+  double frameTime = 0;
+  int64_t frameTarget = 0; // 当前帧计划显示的 vsync
+  double frameDuration = 1.0 / 25;
+  double appliedRate = 1.0;
+  DecodeDegradation degradation{DecodeDegradation::SkipNonReference};
+  DecodeDegradation::Level appliedLevel = DecodeDegradation::Full;
+  bool waitKeyframe = false;
+  Uint64 decodeCounter = 0;      // 自上次取帧以来 send/receive 的计数
+  std::size_t decodedFrames = 0; // 自上次取帧以来解出的帧数
+  std::size_t droppedFrames = 0;
+
+  std::atomic<bool> quit{false};
+  std::atomic<bool> discardChanged{false}; // 待解复用线程应用新的 discard
+  std::atomic<bool> inputEnded{false};     // 输入已读到结尾
+  bool decoderFlushed = false;
+  bool decoderDrained = false;
+  bool filterFinished = false;
+  std::thread demuxer;
+  std::unique_ptr<PacketQueue> videoPackets; // 直播模式的视频包队列
+  std::unique_ptr<LatencyController> latencyController;
+  std::unique_ptr<FrameExporter> exporter;
+
+  std::vector<int> audioStreams; // 所有音轨的流序号
+  int subtitleStream = -1;
+  AVCodecContext *subtitleCodecContext = nullptr;
+  std::unique_ptr<SubtitleStream> subtitles;
+  std::mutex routingMutex; // 保护直播解复用线程对音频流/字幕流的访问
+};
+
+// D3D11 后备缓冲区异步读回
+// Present 前把后备缓冲区 CopyResource 到一环暂存纹理，GPU 拷贝与后续渲染
+// 并行；两帧之后再以 DO_NOT_WAIT 方式 Map 取回，GPU 尚未完成就留到下一次
+// Paint，渲染线程不等待 GPU。只能在渲染线程使用。
+class StagingReadback {
+public:
+  static constexpr std::size_t depth = 3; // 暂存纹理数
+  static constexpr std::size_t lag = 2;   // 拷贝发出后至少隔几帧再读取
+
+  explicit StagingReadback(SDL_Renderer *render) {
+    // SDL 返回的设备已增加引用。
+    device.Attach(SDL_RenderGetD3D11Device(render));
+    if (device)
+      device->GetImmediateContext(&context);
+  }
+
+  // 没有 D3D11 设备，或后备缓冲区不是单采样 BGRA 时不可用。
+  bool available() const { return context && !unsupported; }
+
+  // 发出当前后备缓冲区的拷贝。环已满或不可用时返回 false。
+  bool Copy(SDL_Renderer *render, int64_t pts) {
+    if (issued - collected == entries.size())
+      return false;
+
+    // 先把 SDL 排队的绘制提交给 D3D11，再取当前绑定的渲染目标。
+    SDL_RenderFlush(render);
+    Microsoft::WRL::ComPtr<ID3D11RenderTargetView> view;
+    context->OMGetRenderTargets(1, &view, nullptr);
+    if (!view)
+      return false;
+    Microsoft::WRL::ComPtr<ID3D11Resource> resource;
+    view->GetResource(&resource);
+    Microsoft::WRL::ComPtr<ID3D11Texture2D> backBuffer;
+    if (!resource || FAILED(resource.As(&backBuffer))) {
+      unsupported = true;
+      return false;
+    }
+
+    D3D11_TEXTURE2D_DESC desc;
+    backBuffer->GetDesc(&desc);
+    if (desc.Format != DXGI_FORMAT_B8G8R8A8_UNORM ||
+        desc.SampleDesc.Count != 1) {
+      unsupported = true;
+      return false;
+    }
+
+    // 暂存纹理只在窗口尺寸变化时重新创建。
+    auto &entry = entries[issued % entries.size()];
+    if (!entry.texture || entry.width != static_cast<int>(desc.Width) ||
+        entry.height != static_cast<int>(desc.Height)) {
+      entry.texture.Reset();
+      desc.MipLevels = 1;
+      desc.ArraySize = 1;
+      desc.Usage = D3D11_USAGE_STAGING;
+      desc.BindFlags = 0;
+      desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+      desc.MiscFlags = 0;
+      if (FAILED(device->CreateTexture2D(&desc, nullptr, &entry.texture)))
+        return false;
+      entry.width = static_cast<int>(desc.Width);
+      entry.height = static_cast<int>(desc.Height);
+    }
+
+    context->CopyResource(entry.texture.Get(), backBuffer.Get());
+    entry.pts = pts;
+    ++issued;
+    return true;
+  }
+
+  // 取回最早一次拷贝，交给 consume(pixels, pitch, width, height, pts)。
+  // wait 为 false 时只取已隔 lag 帧且 GPU 已完成的拷贝，否则返回 false。
+  template <typename Consume> bool Collect(bool wait, Consume &&consume) {
+    if (issued == collected || (!wait && issued - collected < lag))
+      return false;
+
+    auto &entry = entries[collected % entries.size()];
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    auto result = context->Map(entry.texture.Get(), 0, D3D11_MAP_READ,
+                               wait ? 0 : D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped);
+    if (result == DXGI_ERROR_WAS_STILL_DRAWING)
+      return false;
+    if (SUCCEEDED(result)) {
+      consume(static_cast<const uint8_t *>(mapped.pData),
+              static_cast<int>(mapped.RowPitch), entry.width, entry.height,
+              entry.pts);
+      context->Unmap(entry.texture.Get(), 0);
+    }
+    ++collected;
+    return true;
+  }
+
+private:
+  struct Entry {
+    Microsoft::WRL::ComPtr<ID3D11Texture2D> texture;
+    int width = 0;
+    int height = 0;
+    int64_t pts = 0;
+  };
+
+  Microsoft::WRL::ComPtr<ID3D11Device> device;
+  Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
+  std::array<Entry, depth> entries;
+  std::size_t issued = 0;
+  std::size_t collected = 0;
+  bool unsupported = false;
+};
+
+// 渲染输出录制
+// Paint 在 Present 前取得后备缓冲区，放入三重缓冲的暂存槽，独立编码线程负责
+// 颜色转换、编码和封装。没有空闲暂存槽时丢弃该帧并计数，从不阻塞界面。
+// D3D11 渲染器经 StagingReadback 晚两帧异步读回；其他渲染器（软件、OpenGL、
+// D3D9）退回同步的 SDL_RenderReadPixels，每帧仍有一次 GPU 到 CPU 的等待。
+class Recorder {
+public:
+  Recorder(const std::string &path, const std::string &codecName)
+      : path(path), codecName(codecName) {
+    worker = std::thread(&Recorder::Run, this);
+  }
+
+  // 须在渲染线程销毁：尚未取回的异步拷贝在这里等待完成并送去编码。
+  ~Recorder() {
+    if (readback)
+      DrainReadback();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    condition.notify_all();
+    if (worker.joinable())
+      worker.join();
+  }
+
+  void Capture(SDL_Renderer *render) {
+    int width = 0;
+    int height = 0;
+    if (SDL_GetRendererOutputSize(render, &width, &height) != 0 ||
+        width <= 1 || height <= 1)
+      return;
+
+    auto now = SDL_GetPerformanceCounter();
+    if (!startCounter)
+      startCounter = now;
+    auto pts = static_cast<int64_t>((now - startCounter) * 1000 /
+                                    SDL_GetPerformanceFrequency());
+
+    if (!readbackChecked) {
+      readbackChecked = true;
+      readback = std::make_unique<StagingReadback>(render);
+      if (!readback->available()) {
+        readback.reset();
+        SDL_Log("recorder: no D3D11 device, using synchronous readback");
+      }
+    }
+
+    if (readback) {
+      {
+        FF_TRACE_SCOPE("recorder collect");
+        readback->Collect(false, [this](auto... args) { Submit(args...); });
+      }
+      if (readback->Copy(render, pts))
+        return;
+      if (readback->available()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++droppedFrames;
+        return;
+      }
+      // 后备缓冲区无法拷贝时改用同步读回，已发出的拷贝先取回。
+      SDL_Log("recorder: back buffer not copyable, using synchronous readback");
+      DrainReadback();
+      readback.reset();
+    }
+
+    auto slot = AcquireSlot();
+    if (!slot)
+      return;
+    // 槽位只在窗口尺寸变化时重新分配。
+    slot->width = width;
+    slot->height = height;
+    slot->pitch = width * 4;
+    slot->pixels.resize(static_cast<std::size_t>(slot->pitch) * height);
+    if (SDL_RenderReadPixels(render, nullptr, SDL_PIXELFORMAT_ARGB8888,
+                             slot->pixels.data(), slot->pitch) != 0) {
+      return;
+    }
+    slot->pts = pts;
+    Publish();
+  }
+
+  std::size_t encoded() const { return encodedFrames.load(); }
+  std::size_t dropped() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return droppedFrames;
+  }
+
+private:
+  struct Slot {
+    std::vector<uint8_t> pixels;
+    int width = 0;
+    int height = 0;
+    int pitch = 0;
+    int64_t pts = 0;
+  };
+
+  void DrainReadback() {
+    while (readback->Collect(true, [this](auto... args) { Submit(args...); }))
+      ;
+  }
+
+  // 没有空闲槽位时丢弃该帧并返回 nullptr。
+  Slot *AcquireSlot() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (failed || writeIndex - readIndex == slots.size()) {
+      ++droppedFrames;
+      return nullptr;
+    }
+    return &slots[writeIndex % slots.size()];
+  }
+
+  void Publish() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++writeIndex;
+    }
+    condition.notify_all();
+  }
+
+  // 异步读回的一帧：按行拷入槽位，暂存纹理的行距通常大于 width * 4。
+  void Submit(const uint8_t *pixels, int pitch, int width, int height,
+              int64_t pts) {
+    auto slot = AcquireSlot();
+    if (!slot)
+      return;
+    slot->width = width;
+    slot->height = height;
+    slot->pitch = width * 4;
+    slot->pixels.resize(static_cast<std::size_t>(slot->pitch) * height);
+    for (int y = 0; y < height; ++y) {
+      std::memcpy(slot->pixels.data() + static_cast<std::size_t>(y) *
+                                            slot->pitch,
+                  pixels + static_cast<std::size_t>(y) * pitch, slot->pitch);
+    }
+    slot->pts = pts;
+    Publish();
+  }
+
+  void Run() {
+    Foundation::Trace::SetThreadName("recorder");
+    while (true) {
+      Slot *slot = nullptr;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock,
+                       [this]() { return quit || writeIndex > readIndex; });
+        if (writeIndex == readIndex)
+          break;
+        slot = &slots[readIndex % slots.size()];
+      }
+
+      if (!codecContext && !Open(slot->width, slot->height)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        failed = true;
+        readIndex = writeIndex;
+        continue;
+      }
+      FF_TRACE_SCOPE("recorder encode");
+      Convert(*slot);
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++readIndex;
+      }
+      Encode(frame);
+    }
+
+    Close();
+  }
+
+  bool Open(int width, int height) {
+    const AVCodec *codec = nullptr;
+    if (codecName == "ffv1") {
+      codec = avcodec_find_encoder(AV_CODEC_ID_FFV1);
+    } else {
+      codec = avcodec_find_encoder_by_name("libx264");
+      if (!codec)
+        codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+    }
+    if (!codec) {
+      SDL_Log("recorder: encoder %s not found", codecName.c_str());
+      return false;
+    }
+
+    if (avformat_alloc_output_context2(&formatContext, nullptr, nullptr,
+                                       path.c_str()) < 0)
+      return false;
+
+    codecContext = avcodec_alloc_context3(codec);
+    if (!codecContext)
+      return false;
+    // yuv420p 要求宽高为偶数。
+    codecContext->width = width & ~1;
+    codecContext->height = height & ~1;
+    codecContext->time_base = av_make_q(1, 1000);
+    codecContext->framerate = av_make_q(60, 1);
+    codecContext->pix_fmt = codec->id == AV_CODEC_ID_FFV1 ? AV_PIX_FMT_YUV444P
+                                                          : AV_PIX_FMT_YUV420P;
+    codecContext->gop_size = 120;
+    if (formatContext->oformat->flags & AVFMT_GLOBALHEADER)
+      codecContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    av_opt_set(codecContext->priv_data, "preset", "ultrafast", 0);
+    av_opt_set(codecContext->priv_data, "tune", "zerolatency", 0);
+
+    if (avcodec_open2(codecContext, codec, nullptr) < 0)
+      return false;
+
+    stream = avformat_new_stream(formatContext, nullptr);
+    if (!stream ||
+        avcodec_parameters_from_context(stream->codecpar, codecContext) < 0)
+      return false;
+    stream->time_base = codecContext->time_base;
+
+    if (!(formatContext->oformat->flags & AVFMT_NOFILE) &&
+        avio_open(&formatContext->pb, path.c_str(), AVIO_FLAG_WRITE) < 0)
+      return false;
+    if (avformat_write_header(formatContext, nullptr) < 0)
+      return false;
+    headerWritten = true;
+
+    frame = av_frame_alloc();
+    if (!frame)
+      return false;
+    frame->format = codecContext->pix_fmt;
+    frame->width = codecContext->width;
+    frame->height = codecContext->height;
+    return av_frame_get_buffer(frame, 0) >= 0;
+  }
+
+  void Convert(const Slot &slot) {
+    // 编码器仍持有上一帧引用时，make_writable 会换用新的缓冲区。
+    if (av_frame_make_writable(frame) < 0)
+      return;
+
+    swsContext = sws_getCachedContext(
+        swsContext, slot.width, slot.height, AV_PIX_FMT_BGRA,
+        codecContext->width, codecContext->height, codecContext->pix_fmt,
+        SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+    if (!swsContext)
+      return;
+
+    const uint8_t *source[] = {slot.pixels.data()};
+    const int sourceStride[] = {slot.pitch};
+    sws_scale(swsContext, source, sourceStride, 0, slot.height, frame->data,
+              frame->linesize);
+
+    // 同一毫秒内的两次 Paint 顺延 1ms，保证 pts 单调递增。
+    frame->pts = (std::max)(slot.pts, lastPts + 1);
+    lastPts = frame->pts;
+  }
+
+  void Encode(AVFrame *input) {
+    if (avcodec_send_frame(codecContext, input) < 0)
+      return;
+
+    auto packet = gPacketPool.acquire();
+    while (packet && avcodec_receive_packet(codecContext, packet) == 0) {
+      av_packet_rescale_ts(packet, codecContext->time_base, stream->time_base);
+      packet->stream_index = stream->index;
+      av_interleaved_write_frame(formatContext, packet);
+      if (input)
+        ++encodedFrames;
+    }
+    gPacketPool.release(packet);
+  }
+
+  void Close() {
+    if (codecContext && headerWritten) {
+      Encode(nullptr);
+      av_write_trailer(formatContext);
+    }
+
+    if (formatContext && !(formatContext->oformat->flags & AVFMT_NOFILE))
+      avio_closep(&formatContext->pb);
+    if (formatContext)
+      avformat_free_context(formatContext);
+    formatContext = nullptr;
+
+    avcodec_free_context(&codecContext);
+    if (frame)
+      av_frame_free(&frame);
+    frame = nullptr;
+    sws_freeContext(swsContext);
+    swsContext = nullptr;
+
+    SDL_Log("recorder: %s, %zu frames encoded, %zu dropped", path.c_str(),
+            encodedFrames.load(), droppedFrames);
+  }
+
+  std::string path;
+  std::string codecName;
+
+  std::thread worker;
+  mutable std::mutex mutex;
+  std::condition_variable condition;
+  std::array<Slot, 3> slots;
+  std::size_t writeIndex = 0;
+  std::size_t readIndex = 0;
+  std::size_t droppedFrames = 0;
+  std::atomic<std::size_t> encodedFrames{0};
+  bool failed = false;
+  bool quit = false;
+  Uint64 startCounter = 0;
+  std::unique_ptr<StagingReadback> readback; // 仅渲染线程访问
+  bool readbackChecked = false;
+
+  AVFormatContext *formatContext = nullptr;
+  AVCodecContext *codecContext = nullptr;
+  AVStream *stream = nullptr;
+  AVFrame *frame = nullptr;
+  SwsContext *swsContext = nullptr;
+  int64_t lastPts = -1;
+  bool headerWritten = false;
+};
+
+} // namespace stream
+
+namespace Foundation {
+
+class Window {
+public:
+  Window() {
+    window = SDL_CreateWindow("FFPlayer", SDL_WINDOWPOS_UNDEFINED,
+                              SDL_WINDOWPOS_UNDEFINED, 850, 600,
+                              SDL_WINDOW_RESIZABLE);
+    // 启动即录制时优先 D3D11 渲染器，以便异步读回后备缓冲区；不录制时沿用
+    // SDL 的默认选择，F9 临时录制在其他渲染器上退回同步读回。默认优先级，
+    // 环境变量 SDL_RENDER_DRIVER 仍可覆盖，不可用时 SDL 依次尝试其他渲染器。
+    if (!gOptions.recordPath.empty()) {
+      SDL_SetHintWithPriority(SDL_HINT_RENDER_DRIVER, "direct3d11",
+                              SDL_HINT_DEFAULT);
+    }
+    render = SDL_CreateRenderer(
+        window, -1,
+        /*SDL_RENDERER_SOFTWARE | */ SDL_RENDERER_ACCELERATED |
+            SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_TARGETTEXTURE);
+
+    texture = SDL_CreateTexture(render, SDL_PIXELFORMAT_RGBA8888,
+                                SDL_TEXTUREACCESS_TARGET, 850, 600);
+    videoTextures = std::make_unique<stream::TexturePool>(render);
+
+    SDL_SetWindowMinimumSize(window, 750, 400);
+
+    SDL_DisplayMode mode;
+    if (SDL_GetWindowDisplayMode(window, &mode) == 0)
+      stream::gPresentation.SetNominalRefresh(mode.refresh_rate);
+
+    if (!gOptions.recordPath.empty()) {
+      ToggleRecording();
+    }
+
+    //SDL_FPoint gravity = {0, 0};
+    //world = Foundation::Particle::World::CreateWorld(gravity);
+    //SDL_Point position = {850 / 2, 600};
     //SDL_FPoint direct = {5, -5};
     //launcher = Foundation::Particle::Launcher::CreateLauncher(position, direct,
     //                                                          100, world);
   }
   ~Window() {
-    SDL_DestroyTexture(videoTexture);
+    recorder.reset();
     videoTexture = nullptr;
+    videoTextures.reset();
     SDL_DestroyTexture(texture);
     texture = nullptr;
     SDL_DestroyRenderer(render);
@@ -766,6 +4190,7 @@ public:
     AutoFramesPerSecond renderCounter;
 
     static constexpr SDL_Rect rect = {0, 0, 850, 600};
+    bool uploadedFrame = false;
 
     SDL_Rect windowRectangle = rect;
     SDL_GetWindowSize(window, &windowRectangle.w, &windowRectangle.h);
@@ -773,8 +4198,11 @@ public:
     if (windowRectangle.h == 0)
       return;
 
+    FF_TRACE_SCOPE("Paint");
+
     // backgroud: 750*480
     {
+      FF_TRACE_SCOPE("Paint background");
       SDL_SetRenderTarget(render, texture);
       SDL_SetRenderDrawColor(render, 255, 255, 255, 255);
       SDL_RenderClear(render);
@@ -796,21 +4224,21 @@ public:
     }
 
     {
+      FF_TRACE_SCOPE("Paint video");
       using namespace stream;
-      if (gFFmpegVideoStream) {
-        if (!videoTexture) {
-          videoTexture = SDL_CreateTexture(
-              render, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING,
-              gFFmpegVideoStream->width(), gFFmpegVideoStream->height());
+      if (gFFmpegVideoStream && gFFmpegVideoStream->ready()) {
+        // 纹理随帧的分辨率/格式切换，未上传新帧时继续显示上一帧的纹理。
+        if (auto uploaded = gFFmpegVideoStream->Read(*videoTextures)) {
+          videoTexture = uploaded;
+          uploadedFrame = true;
         }
-
-        SDL_SetRenderTarget(render, videoTexture);
-        SDL_RenderClear(render);
-        gFFmpegVideoStream->Read(videoTexture);
-        SDL_SetRenderTarget(render, nullptr);
       }
 
-      SDL_RenderCopy(render, videoTexture, nullptr, &videoRectangle);
+      if (videoTexture)
+        SDL_RenderCopy(render, videoTexture, nullptr, &videoRectangle);
+      if (gFFmpegVideoStream) {
+        gFFmpegVideoStream->PresentSubtitles(render, videoRectangle);
+      }
     }
 
     // Wav: {0, videoRectangle.h, rect.w, rect.h - videoRectangle.h}
@@ -820,6 +4248,7 @@ public:
       wavRectangle.h -= wavRectangle.y;
       wavRectangle.y += 2;
       wavRectangle.h -= 4;
+      FF_TRACE_SCOPE("Paint wav");
       SDL_SetRenderTarget(render, texture);
 
       SDL_SetRenderDrawColor(render, 0, 0, 0, 255);
@@ -876,6 +4305,7 @@ public:
 
     // FPS
     {
+      FF_TRACE_SCOPE("Paint stats");
       SDL_Rect notepadRectangle = windowRectangle;
       notepadRectangle.x = videoRectangle.w;
       notepadRectangle.w -= notepadRectangle.x;
@@ -899,36 +4329,197 @@ public:
       notepad.write(render, "renderFPS: ", notepadRectangle.x, 70, 50);
       notepad.write(render, std::to_string(renderFPS) + "ms",
                     notepadRectangle.x + 50, 70, 100);
+      notepad.write(render, "rate: ", notepadRectangle.x, 90, 50);
+      notepad.write(render,
+                    std::to_string(stream::gPlaybackClock.rate()) + "x",
+                    notepadRectangle.x + 50, 90, 100);
+      if (recorder) {
+        notepad.write(render, "record: ", notepadRectangle.x, 110, 50);
+        notepad.write(render,
+                      std::to_string(recorder->encoded()) + "/" +
+                          std::to_string(recorder->dropped()) + " dropped",
+                      notepadRectangle.x + 50, 110, 100);
+      }
+      if (stream::gFFmpegVideoStream &&
+          stream::gFFmpegVideoStream->latency() >= 0) {
+        // 有端到端数据时同时显示，否则只有接收到显示的延迟。
+        auto text = "rx " +
+                    std::to_string(static_cast<int>(
+                        stream::gFFmpegVideoStream->latency() * 1000)) +
+                    "ms";
+        auto endToEnd = stream::gFFmpegVideoStream->endToEndLatency();
+        if (endToEnd >= 0)
+          text += " e2e " + std::to_string(static_cast<int>(endToEnd * 1000)) +
+                  "ms";
+        notepad.write(render, "latency: ", notepadRectangle.x, 130, 50);
+        notepad.write(render, text, notepadRectangle.x + 50, 130, 150);
+      }
+      if (firstFrameTime >= 0) {
+        notepad.write(render, "first frame: ", notepadRectangle.x, 150, 50);
+        notepad.write(render, std::to_string(firstFrameTime) + "ms",
+                      notepadRectangle.x + 50, 150, 100);
+      }
+      if (stream::gFFmpegVideoStream && stream::gFFmpegVideoStream->ready()) {
+        notepad.write(render, "decode: ", notepadRectangle.x, 170, 50);
+        notepad.write(render, stream::gFFmpegVideoStream->degradationLevel(),
+                      notepadRectangle.x + 50, 170, 100);
+        notepad.write(render, "cadence: ", notepadRectangle.x, 210, 50);
+        notepad.write(render, stream::gFFmpegVideoStream->cadence(),
+                      notepadRectangle.x + 50, 210, 100);
+        auto track = stream::gFFmpegVideoStream->audioTrack();
+        if (!track.empty()) {
+          notepad.write(render, "audio: ", notepadRectangle.x, 190, 50);
+          notepad.write(render, track, notepadRectangle.x + 50, 190, 100);
+        }
+      }
 
       fpsCounter.reset();
     }
 
-    SDL_RenderPresent(render);
+    if (recorder) {
+      FF_TRACE_SCOPE("Paint capture");
+      recorder->Capture(render);
+    }
+
+    {
+      FF_TRACE_SCOPE("SDL_RenderPresent");
+      SDL_RenderPresent(render);
+    }
+    stream::gPresentation.OnPresent();
+
+    // 首帧耗时：从进程启动到第一帧视频呈现完成。
+    if (uploadedFrame && firstFrameTime < 0) {
+      firstFrameTime = (SDL_GetPerformanceCounter() - gStartupCounter) * 1.0f /
+                       gFrequency;
+      SDL_Log("time to first frame: %.1fms", firstFrameTime);
+    }
   } // namespace Foundation
 
+  bool firstFrameShown() const { return firstFrameTime >= 0; }
+
+  // 开始/停止录制渲染输出，未指定 --record 时写入程序目录下的 capture.mkv。
+  void ToggleRecording() {
+    if (recorder) {
+      recorder.reset();
+      return;
+    }
+
+    auto path = gOptions.recordPath;
+    if (path.empty()) {
+      std::filesystem::path directory(
+          wil::GetModuleFileNameW<std::wstring>(nullptr));
+      directory = directory.parent_path().append("capture.mkv");
+      path = SysWideToMultiByte(directory.c_str(), CP_ACP);
+    }
+    recorder = std::make_unique<stream::Recorder>(path, gOptions.recordCodec);
+  }
+
 private:
   Notepad notepad;
   SDL_Window *window = nullptr;
   SDL_Renderer *render = nullptr;
   SDL_Texture *texture = nullptr;
-  SDL_Texture *videoTexture = nullptr;
+  std::unique_ptr<stream::TexturePool> videoTextures;
+  SDL_Texture *videoTexture = nullptr; // 当前显示的纹理，由 videoTextures 持有
   std::shared_ptr<Particle::Launcher> launcher;
   std::shared_ptr<Particle::World> world;
+  std::unique_ptr<stream::Recorder> recorder;
+  float firstFrameTime = -1; // ms
 };
 
 } // namespace Foundation
 
+void HandleKeyDown(Foundation::Window &window, SDL_Keycode key) {
+  using namespace stream;
+  switch (key) {
+  // 变速播放：[ 减速，] 加速，Backspace 恢复原速
+  case SDLK_LEFTBRACKET:
+    gPlaybackClock.stepRate(-1);
+    break;
+  case SDLK_RIGHTBRACKET:
+    gPlaybackClock.stepRate(1);
+    break;
+  case SDLK_BACKSPACE:
+    gPlaybackClock.setRate(1.0);
+    break;
+  // 切换音轨
+  case SDLK_a:
+    if (gFFmpegVideoStream && gFFmpegVideoStream->ready())
+      gFFmpegVideoStream->SwitchAudioTrack();
+    break;
+  // 录制渲染输出
+  case SDLK_F9:
+    window.ToggleRecording();
+    break;
+  // 写出当前追踪窗口
+  case SDLK_F12:
+    if (!gOptions.tracePath.empty()) {
+      Foundation::Trace::Flush(gOptions.tracePath);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+// 异步启动：窗口与渲染器先就绪；媒体打开与视频解码器初始化在后台进行，
+// 首帧显示之后再在后台预热音频设备、音频解码器和字幕管线。
 void RunSimpleFFPlayerDemo() {
   auto window = std::make_unique<Foundation::Window>();
 
   using namespace stream;
-  gLocalAudioStream = std::make_unique<AudioStream>(nullptr);
-  gFFmpegVideoStream = std::make_unique<VideoStream>();
+  struct Startup {
+    std::unique_ptr<AudioStream> localAudio;
+    VideoStream::Warmup media;
+  };
+
+  using Foundation::Scheduler;
+  auto &scheduler = *Foundation::gScheduler;
+  auto opening = scheduler.Submit(Scheduler::Decode, []() {
+    FF_TRACE_SCOPE("open media");
+    return std::make_unique<VideoStream>();
+  });
+  std::future<Startup> warming;
+  bool warmedUp = false;
+
+  auto isReady = [](const auto &future) {
+    return future.valid() && future.wait_for(std::chrono::seconds(0)) ==
+                                 std::future_status::ready;
+  };
 
   bool quit = false;
   SDL_Event event;
   Foundation::AutoFramesPerSecond Counter;
   while (!quit) {
+    if (isReady(opening)) {
+      gFFmpegVideoStream = opening.get();
+    }
+
+    if (!warmedUp && !warming.valid() && !opening.valid() &&
+        (window->firstFrameShown() || !gFFmpegVideoStream->ready())) {
+      warming = scheduler.Submit(
+          Scheduler::Decode, [stream = gFFmpegVideoStream.get()]() {
+            FF_TRACE_SCOPE("warm up audio");
+            if (!SDL_WasInit(SDL_INIT_AUDIO) &&
+                SDL_InitSubSystem(SDL_INIT_AUDIO) != 0)
+              SDL_Log("audio init failed: %s", SDL_GetError());
+            Startup startup;
+            if (SDL_WasInit(SDL_INIT_AUDIO))
+              startup.localAudio = std::make_unique<AudioStream>(nullptr);
+            startup.media = stream->WarmUp();
+            return startup;
+          });
+    }
+
+    if (isReady(warming)) {
+      auto startup = warming.get();
+      SDL_LockAudio();
+      gLocalAudioStream = std::move(startup.localAudio);
+      SDL_UnlockAudio();
+      gFFmpegVideoStream->Install(std::move(startup.media));
+      warmedUp = true;
+    }
+
     if (SDL_PollEvent(&event)) {
       switch (event.type) {
       case SDL_QUIT: {
@@ -938,6 +4529,9 @@ void RunSimpleFFPlayerDemo() {
       case SDL_KEYUP:
       case SDL_KEYDOWN: {
         SDL_Log("event: key down, %d", event.key.type);
+        if (event.type == SDL_KEYDOWN) {
+          HandleKeyDown(*window, event.key.keysym.sym);
+        }
       } break;
 
       default:
@@ -951,9 +4545,1041 @@ void RunSimpleFFPlayerDemo() {
     SDL_Delay(1);
   }
 
+  // 后台任务仍持有 VideoStream，先中断阻塞的打开与探测，再等待其结束。
+  gAbortIo = true;
+  if (opening.valid())
+    gFFmpegVideoStream = opening.get();
+  if (warming.valid())
+    warming.get();
+
   gFFmpegVideoStream = nullptr;
   gLocalAudioStream = nullptr;
   window = nullptr;
+
+  if (!gOptions.tracePath.empty()) {
+    Foundation::Trace::Flush(gOptions.tracePath);
+  }
+}
+
+// 性能回归基准：FFPlayer.exe --benchmark [结果.json] [--baseline 基线.json]
+// 运行时自行编码测试图案与正弦音（不依赖素材和网络），测量解复用、视频解码、
+// 音频解码与重采样、纹理上传、文字叠加、粒子更新和图元绘制。渲染相关项走 SDL
+// 软件渲染器，不创建窗口也不需要 GPU。单次运行往往不到 1 毫秒，计时噪声会
+// 盖过差异，所以每个样本重复运行至少 gMinSampleMs，按处理的包/帧/次数折算成
+// 单项耗时，取多个样本的中位数；超出基线容差即视为回归，进程返回非零。
+namespace Benchmark {
+
+constexpr int gRepetitions = 5;      // 每项样本数，取中位数
+constexpr double gMinSampleMs = 100; // 每个样本的最短测量时间
+constexpr int gFrameRate = 25;       // 合成视频帧率
+constexpr int gFrames = 50;          // 合成视频帧数
+constexpr int gSampleRate = 48000;   // 合成音频采样率
+constexpr int gCanvasWidth = 850;    // 软件渲染画布，与窗口默认尺寸一致
+constexpr int gCanvasHeight = 600;
+
+struct Result {
+  std::string name;
+  double us = 0;          // 单项耗时中位数（微秒）
+  std::size_t items = 0;  // 每次运行处理的包/帧/次数
+  std::size_t runs = 0;   // 最后一个样本重复运行的次数
+  double baseline = -1;   // 基线耗时，没有基线时为负数
+  bool regressed = false;
+};
+
+// 连续测量：先预热一次，再取 gRepetitions 个样本的中位数。每个样本重复运行
+// function 直到累计至少 gMinSampleMs，耗时除以累计处理的项数。
+template <typename Function>
+Result Measure(const std::string &name, Function &&function) {
+  function();
+
+  std::vector<double> samples;
+  std::size_t items = 0;
+  std::size_t runs = 0;
+  for (int i = 0; i < gRepetitions; ++i) {
+    std::size_t total = 0;
+    runs = 0;
+    auto begin = SDL_GetPerformanceCounter();
+    double elapsed = 0;
+    do {
+      items = function();
+      total += items;
+      ++runs;
+      elapsed = (SDL_GetPerformanceCounter() - begin) * 1000.0 /
+                SDL_GetPerformanceFrequency();
+    } while (elapsed < gMinSampleMs);
+    samples.push_back(elapsed * 1000.0 /
+                      static_cast<double>((std::max)(total, std::size_t(1))));
+  }
+  std::sort(samples.begin(), samples.end());
+
+  Result result;
+  result.name = name;
+  result.us = samples[samples.size() / 2];
+  result.items = items;
+  result.runs = runs;
+  SDL_Log("benchmark: %s %.3fus/item (%zu items x %zu runs per sample)",
+          name.c_str(), result.us, items, runs);
+  return result;
+}
+
+// 测试媒体：视频为斜向移动的渐变图案，音频为 440Hz 正弦音（AAC）。
+class MediaWriter {
+public:
+  MediaWriter(const std::string &path, const AVCodec *videoCodec, int width,
+              int height)
+      : path(path) {
+    valid = Open(videoCodec, width, height);
+  }
+  ~MediaWriter() { Close(); }
+
+  bool Write() {
+    if (!valid)
+      return false;
+
+    int64_t samples = 0;
+    for (int index = 0; index < gFrames; ++index) {
+      if (av_frame_make_writable(videoFrame) < 0)
+        return false;
+      FillPattern(videoFrame, index);
+      videoFrame->pts = index;
+      if (!Encode(videoContext, videoStream, videoFrame))
+        return false;
+
+      // 音频写到与当前视频帧对齐的位置。
+      auto until = static_cast<int64_t>(index + 1) * gSampleRate / gFrameRate;
+      while (samples < until) {
+        if (av_frame_make_writable(audioFrame) < 0)
+          return false;
+        FillTone(audioFrame, samples);
+        audioFrame->pts = samples;
+        samples += audioFrame->nb_samples;
+        if (!Encode(audioContext, audioStream, audioFrame))
+          return false;
+      }
+    }
+
+    Encode(videoContext, videoStream, nullptr);
+    Encode(audioContext, audioStream, nullptr);
+    return av_write_trailer(formatContext) == 0;
+  }
+
+private:
+  bool Open(const AVCodec *videoCodec, int width, int height) {
+    auto audioCodec = avcodec_find_encoder(AV_CODEC_ID_AAC);
+    if (!videoCodec || !audioCodec)
+      return false;
+
+    if (avformat_alloc_output_context2(&formatContext, nullptr, "matroska",
+                                       path.c_str()) < 0)
+      return false;
+    auto globalHeader = formatContext->oformat->flags & AVFMT_GLOBALHEADER;
+
+    videoContext = avcodec_alloc_context3(videoCodec);
+    if (!videoContext)
+      return false;
+    videoContext->width = width;
+    videoContext->height = height;
+    videoContext->time_base = av_make_q(1, gFrameRate);
+    videoContext->framerate = av_make_q(gFrameRate, 1);
+    videoContext->pix_fmt = AV_PIX_FMT_YUV420P;
+    videoContext->gop_size = gFrameRate;
+    videoContext->bit_rate = static_cast<int64_t>(width) * height * 4;
+    if (globalHeader)
+      videoContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    av_opt_set(videoContext->priv_data, "preset", "veryfast", 0);
+    if (avcodec_open2(videoContext, videoCodec, nullptr) < 0)
+      return false;
+
+    audioContext = avcodec_alloc_context3(audioCodec);
+    if (!audioContext)
+      return false;
+    audioContext->sample_fmt = AV_SAMPLE_FMT_FLTP;
+    audioContext->sample_rate = gSampleRate;
+    audioContext->time_base = av_make_q(1, gSampleRate);
+    audioContext->bit_rate = 128000;
+    av_channel_layout_default(&audioContext->ch_layout, 2);
+    if (globalHeader)
+      audioContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    if (avcodec_open2(audioContext, audioCodec, nullptr) < 0)
+      return false;
+
+    videoStream = NewStream(videoContext);
+    audioStream = NewStream(audioContext);
+    if (!videoStream || !audioStream)
+      return false;
+
+    if (avio_open(&formatContext->pb, path.c_str(), AVIO_FLAG_WRITE) < 0)
+      return false;
+    if (avformat_write_header(formatContext, nullptr) < 0)
+      return false;
+
+    videoFrame = av_frame_alloc();
+    audioFrame = av_frame_alloc();
+    if (!videoFrame || !audioFrame)
+      return false;
+    videoFrame->format = videoContext->pix_fmt;
+    videoFrame->width = width;
+    videoFrame->height = height;
+    audioFrame->format = audioContext->sample_fmt;
+    audioFrame->sample_rate = gSampleRate;
+    audioFrame->nb_samples =
+        audioContext->frame_size > 0 ? audioContext->frame_size : 1024;
+    av_channel_layout_copy(&audioFrame->ch_layout, &audioContext->ch_layout);
+    return av_frame_get_buffer(videoFrame, 0) >= 0 &&
+           av_frame_get_buffer(audioFrame, 0) >= 0;
+  }
+
+  AVStream *NewStream(AVCodecContext *context) {
+    auto stream = avformat_new_stream(formatContext, nullptr);
+    if (!stream ||
+        avcodec_parameters_from_context(stream->codecpar, context) < 0)
+      return nullptr;
+    stream->time_base = context->time_base;
+    return stream;
+  }
+
+  static void FillPattern(AVFrame *frame, int index) {
+    for (int y = 0; y < frame->height; ++y) {
+      auto line = frame->data[0] + y * frame->linesize[0];
+      for (int x = 0; x < frame->width; ++x)
+        line[x] = static_cast<uint8_t>(x + y + index * 4);
+    }
+    for (int y = 0; y < frame->height / 2; ++y) {
+      auto u = frame->data[1] + y * frame->linesize[1];
+      auto v = frame->data[2] + y * frame->linesize[2];
+      for (int x = 0; x < frame->width / 2; ++x) {
+        u[x] = static_cast<uint8_t>(128 + y + index * 2);
+        v[x] = static_cast<uint8_t>(64 + x + index * 5);
+      }
+    }
+  }
+
+  static void FillTone(AVFrame *frame, int64_t offset) {
+    for (int channel = 0; channel < frame->ch_layout.nb_channels; ++channel) {
+      auto samples = reinterpret_cast<float *>(frame->data[channel]);
+      for (int i = 0; i < frame->nb_samples; ++i) {
+        samples[i] = 0.5f * sinf(2.0f * static_cast<float>(M_PI) * 440.0f *
+                                 (offset + i) / gSampleRate);
+      }
+    }
+  }
+
+  bool Encode(AVCodecContext *context, AVStream *stream, AVFrame *input) {
+    if (avcodec_send_frame(context, input) < 0)
+      return false;
+
+    auto packet = stream::gPacketPool.acquire();
+    if (!packet)
+      return false;
+    while (avcodec_receive_packet(context, packet) == 0) {
+      av_packet_rescale_ts(packet, context->time_base, stream->time_base);
+      packet->stream_index = stream->index;
+      av_interleaved_write_frame(formatContext, packet);
+    }
+    stream::gPacketPool.release(packet);
+    return true;
+  }
+
+  void Close() {
+    if (formatContext && formatContext->pb)
+      avio_closep(&formatContext->pb);
+    if (formatContext)
+      avformat_free_context(formatContext);
+    formatContext = nullptr;
+
+    avcodec_free_context(&videoContext);
+    avcodec_free_context(&audioContext);
+    if (videoFrame)
+      av_frame_free(&videoFrame);
+    if (audioFrame)
+      av_frame_free(&audioFrame);
+  }
+
+  std::string path;
+  bool valid = false;
+  AVFormatContext *formatContext = nullptr;
+  AVCodecContext *videoContext = nullptr;
+  AVCodecContext *audioContext = nullptr;
+  AVStream *videoStream = nullptr;
+  AVStream *audioStream = nullptr;
+  AVFrame *videoFrame = nullptr;
+  AVFrame *audioFrame = nullptr;
+};
+
+// 预先读出的一路压缩包，解码测量不包含解复用开销。
+struct Packets {
+  Packets() = default;
+  Packets(const Packets &) = delete;
+  Packets &operator=(const Packets &) = delete;
+  ~Packets() {
+    for (auto packet : packets)
+      stream::gPacketPool.release(packet);
+    avcodec_parameters_free(&parameters);
+  }
+
+  AVCodecParameters *parameters = nullptr;
+  std::vector<AVPacket *> packets;
+};
+
+// 读出整个文件；packets 非空时收集 type 对应流的包。返回读到的包总数。
+std::size_t Demux(const std::string &path,
+                  AVMediaType type = AVMEDIA_TYPE_UNKNOWN,
+                  Packets *packets = nullptr) {
+  AVFormatContext *formatContext = nullptr;
+  if (avformat_open_input(&formatContext, path.c_str(), nullptr, nullptr) != 0)
+    return 0;
+
+  std::size_t count = 0;
+  auto stream = -1;
+  if (avformat_find_stream_info(formatContext, nullptr) >= 0 && packets) {
+    stream = av_find_best_stream(formatContext, type, -1, -1, nullptr, 0);
+    if (stream >= 0) {
+      packets->parameters = avcodec_parameters_alloc();
+      avcodec_parameters_copy(packets->parameters,
+                              formatContext->streams[stream]->codecpar);
+    }
+  }
+
+  auto packet = stream::gPacketPool.acquire();
+  while (packet && av_read_frame(formatContext, packet) == 0) {
+    ++count;
+    if (packets && packet->stream_index == stream) {
+      packets->packets.push_back(packet);
+      packet = stream::gPacketPool.acquire();
+    } else {
+      av_packet_unref(packet);
+    }
+  }
+  stream::gPacketPool.release(packet);
+  avformat_close_input(&formatContext);
+  return count;
+}
+
+// 打开解码器并解码全部包（含冲刷），每帧交给 consume。返回解码帧数。
+template <typename Consume>
+std::size_t Decode(const Packets &input, Consume &&consume) {
+  if (!input.parameters)
+    return 0;
+  auto codec = avcodec_find_decoder(input.parameters->codec_id);
+  if (!codec)
+    return 0;
+  auto context = avcodec_alloc_context3(codec);
+  auto frame = av_frame_alloc();
+  std::size_t frames = 0;
+  if (context && frame &&
+      avcodec_parameters_to_context(context, input.parameters) == 0 &&
+      avcodec_open2(context, codec, nullptr) == 0) {
+    auto receive = [&]() {
+      while (avcodec_receive_frame(context, frame) == 0) {
+        consume(context, frame);
+        av_frame_unref(frame);
+        ++frames;
+      }
+    };
+    for (auto packet : input.packets) {
+      avcodec_send_packet(context, packet);
+      receive();
+    }
+    avcodec_send_packet(context, nullptr);
+    receive();
+  }
+  av_frame_free(&frame);
+  avcodec_free_context(&context);
+  return frames;
+}
+
+std::map<std::string, double> ReadBaseline(const std::string &path) {
+  std::map<std::string, double> baseline;
+  std::FILE *file = nullptr;
+  fopen_s(&file, path.c_str(), "rb");
+  if (!file)
+    return baseline;
+
+  std::string content;
+  char buffer[4096];
+  std::size_t read = 0;
+  while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+    content.append(buffer, read);
+  std::fclose(file);
+
+  // 基线就是此前某次运行写出的结果文件；版本 1 的整次耗时（ms）不可比，不读。
+  static const std::regex entry(
+      "\"name\": \"([^\"]+)\", \"us\": ([0-9.eE+-]+)");
+  for (std::sregex_iterator it(content.begin(), content.end(), entry), end;
+       it != end; ++it) {
+    baseline[(*it)[1].str()] = std::atof((*it)[2].str().c_str());
+  }
+  return baseline;
+}
+
+bool WriteResults(const std::string &path, const std::vector<Result> &results,
+                  double tolerance) {
+  std::FILE *file = nullptr;
+  fopen_s(&file, path.c_str(), "wb");
+  if (!file)
+    return false;
+
+  std::fprintf(file, "{\n  \"version\": 2,\n  \"repetitions\": %d,\n",
+               gRepetitions);
+  std::fprintf(file, "  \"min_sample_ms\": %.0f,\n", gMinSampleMs);
+  std::fprintf(file, "  \"tolerance\": %.2f,\n  \"results\": [\n", tolerance);
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const auto &result = results[i];
+    std::fprintf(file,
+                 "    {\"name\": \"%s\", \"us\": %.3f, \"items\": %zu, "
+                 "\"runs\": %zu, \"baseline\": %.3f, \"regressed\": %s}%s\n",
+                 result.name.c_str(), result.us, result.items, result.runs,
+                 result.baseline, result.regressed ? "true" : "false",
+                 i + 1 < results.size() ? "," : "");
+  }
+  std::fprintf(file, "  ]\n}\n");
+  std::fclose(file);
+  return true;
+}
+
+int Run() {
+  auto directory =
+      std::filesystem::temp_directory_path().append("ffplayer-benchmark");
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+
+  auto surface = SDL_CreateRGBSurfaceWithFormat(
+      0, gCanvasWidth, gCanvasHeight, 32, SDL_PIXELFORMAT_ARGB8888);
+  auto render = surface ? SDL_CreateSoftwareRenderer(surface) : nullptr;
+  if (!render) {
+    SDL_Log("benchmark: software renderer unavailable: %s", SDL_GetError());
+    SDL_FreeSurface(surface);
+    return 1;
+  }
+
+  struct Case {
+    const char *codec;
+    int width;
+    int height;
+  };
+  static constexpr Case cases[] = {
+      {"mpeg4", 320, 240},   {"mpeg4", 1280, 720},   {"ffv1", 320, 240},
+      {"ffv1", 1280, 720},   {"libx264", 320, 240},  {"libx264", 1280, 720},
+  };
+
+  auto sizeOf = [](const Case &item) {
+    return std::to_string(item.width) + "x" + std::to_string(item.height);
+  };
+  auto pathOf = [&](const Case &item) {
+    return SysWideToMultiByte(
+        std::filesystem::path(directory)
+            .append(std::string(item.codec) + "-" + sizeOf(item) + ".mkv")
+            .c_str(),
+        CP_UTF8);
+  };
+
+  // 测试媒体互不依赖，并行合成；测量仍逐项串行，避免相互干扰。
+  std::array<bool, std::size(cases)> synthesized = {};
+  Foundation::gScheduler->ParallelFor(
+      0, std::size(cases), 1,
+      [&](std::size_t i) {
+        // 可选编码器（如 libx264）不存在时跳过，基线比较只报告缺失项。
+        const auto &item = cases[i];
+        auto codec = avcodec_find_encoder_by_name(item.codec);
+        if (!codec) {
+          SDL_Log("benchmark: encoder %s not available, skipped", item.codec);
+          return;
+        }
+        auto path = pathOf(item);
+        synthesized[i] =
+            MediaWriter(path, codec, item.width, item.height).Write();
+        if (!synthesized[i])
+          SDL_Log("benchmark: synthesize %s failed", path.c_str());
+      },
+      Foundation::Scheduler::Background);
+
+  std::vector<Result> results;
+  std::string audioPath;
+  for (std::size_t i = 0; i < std::size(cases); ++i) {
+    if (!synthesized[i])
+      continue;
+    const auto &item = cases[i];
+    auto size = sizeOf(item);
+    auto suffix = std::string(item.codec) + "/" + size;
+    auto path = pathOf(item);
+    if (audioPath.empty())
+      audioPath = path;
+
+    results.push_back(
+        Measure("demux/" + suffix, [&]() { return Demux(path); }));
+
+    Packets video;
+    Demux(path, AVMEDIA_TYPE_VIDEO, &video);
+    results.push_back(Measure("video_decode/" + suffix, [&]() {
+      return Decode(video, [](AVCodecContext *, AVFrame *) {});
+    }));
+
+    // 纹理上传只与分辨率有关，每个分辨率用首个可用编码器的解码帧测量一次。
+    auto uploadName = "texture_upload/" + size;
+    if (std::none_of(results.begin(), results.end(),
+                     [&](const Result &r) { return r.name == uploadName; })) {
+      std::vector<AVFrame *> frames;
+      Decode(video, [&](AVCodecContext *, AVFrame *frame) {
+        frames.push_back(av_frame_clone(frame));
+      });
+      stream::TexturePool textures(render);
+      results.push_back(Measure(uploadName, [&]() {
+        for (auto frame : frames) {
+          auto texture = textures.acquire(stream::TexturePool::KeyOf(frame));
+          SDL_UpdateYUVTexture(texture, nullptr, frame->data[0],
+                               frame->linesize[0], frame->data[1],
+                               frame->linesize[1], frame->data[2],
+                               frame->linesize[2]);
+          SDL_RenderCopy(render, texture, nullptr, nullptr);
+        }
+        return frames.size();
+      }));
+      for (auto frame : frames)
+        av_frame_free(&frame);
+    }
+  }
+
+  // 音频解码与重采样：与 AudioStream 一致，输出 S16 立体声 44.1kHz。
+  if (!audioPath.empty()) {
+    Packets audio;
+    Demux(audioPath, AVMEDIA_TYPE_AUDIO, &audio);
+    std::vector<uint8_t> buffer(stream::gAudioMaxFrameSize * 3 / 2);
+    results.push_back(Measure("audio_decode_resample/aac", [&]() {
+      SwrContext *resampler = nullptr;
+      AVChannelLayout stereo = AV_CHANNEL_LAYOUT_STEREO;
+      auto frames = Decode(audio, [&](AVCodecContext *context,
+                                      AVFrame *frame) {
+        if (!resampler) {
+          swr_alloc_set_opts2(&resampler, &stereo, AV_SAMPLE_FMT_S16,
+                              44100, &context->ch_layout,
+                              context->sample_fmt, context->sample_rate, 0,
+                              nullptr);
+          swr_init(resampler);
+        }
+        auto out = buffer.data();
+        swr_convert(resampler, &out, static_cast<int>(buffer.size() / 4),
+                    const_cast<const uint8_t **>(frame->extended_data),
+                    frame->nb_samples);
+      });
+      swr_free(&resampler);
+      return frames;
+    }));
+  }
+
+  // 共享内存导出吞吐：同进程读者线程并发读取，写者从不等待读者。
+  {
+    auto frame = av_frame_alloc();
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = 1280;
+    frame->height = 720;
+    if (av_frame_get_buffer(frame, 0) >= 0) {
+      auto name = "FFPlayer.benchmark." + std::to_string(GetCurrentProcessId());
+      stream::FrameExporter exporter(name, 4);
+      exporter.Write(frame, av_make_q(1, gFrameRate));
+
+      std::atomic<bool> done{false};
+      stream::FrameReader reader(name);
+      reader.Open();
+      std::thread consumer([&]() {
+        stream::FrameReader::Frame received;
+        while (!done)
+          reader.Next(received, 10);
+      });
+      results.push_back(Measure("frame_export/1280x720", [&]() {
+        constexpr std::size_t frames = 100;
+        for (std::size_t i = 0; i < frames; ++i) {
+          frame->pts = static_cast<int64_t>(i);
+          exporter.Write(frame, av_make_q(1, gFrameRate));
+        }
+        return frames;
+      }));
+      done = true;
+      consumer.join();
+      SDL_Log("benchmark: frame_export reader %llu received, %llu dropped",
+              static_cast<unsigned long long>(reader.received()),
+              static_cast<unsigned long long>(reader.dropped()));
+    }
+    av_frame_free(&frame);
+  }
+
+  // 文字叠加：与统计面板相同的 Notepad 路径。
+  {
+    Foundation::Notepad notepad;
+    if (notepad.wait()) {
+      results.push_back(Measure("text_overlay", [&]() {
+        constexpr std::size_t lines = 200;
+        for (std::size_t i = 0; i < lines; ++i) {
+          notepad.write(render, "renderTime: " + std::to_string(i * 0.25f),
+                        10, static_cast<int>(i % 30) * 20, 100);
+        }
+        return lines;
+      }));
+    } else {
+      SDL_Log("benchmark: font not found, text_overlay skipped");
+    }
+  }
+
+  // 粒子更新：与 Paint 中的发射器参数一致。
+  results.push_back(Measure("particle_update", [&]() {
+    constexpr std::size_t steps = 200;
+    auto world = Foundation::Particle::World::CreateWorld({0, 0});
+    auto launcher = Foundation::Particle::Launcher::CreateLauncher(
+        {gCanvasWidth / 2, gCanvasHeight}, {5, -5}, 100, world);
+    for (std::size_t i = 0; i < steps; ++i) {
+      launcher->Shoot(180);
+      world->UpdateWorld(render);
+    }
+    return steps;
+  }));
+
+  // 图元绘制：Paint 波形区的矩形、混合填充、坐标轴与圆。
+  results.push_back(Measure("primitive_draw", [&]() {
+    constexpr std::size_t iterations = 200;
+    SDL_Rect rect = {0, 0, gCanvasWidth, gCanvasHeight};
+    for (std::size_t i = 0; i < iterations; ++i) {
+      SDL_SetRenderDrawColor(render, 0, 0, 0, 255);
+      SDL_RenderClear(render);
+      SDL_RenderDrawRect(render, &rect);
+      SDL_SetRenderDrawBlendMode(render, SDL_BLENDMODE_BLEND);
+      SDL_SetRenderDrawColor(render, 230, 230, 230, 200);
+      SDL_Rect blendRect = {1, 5, rect.w - 1, rect.h - 10};
+      SDL_RenderFillRect(render, &blendRect);
+      SDL_SetRenderDrawBlendMode(render, SDL_BLENDMODE_NONE);
+      SDL_SetRenderDrawColor(render, 250, 250, 250, 200);
+      SDL_RenderDrawLine(render, 0, 0, 0, rect.h);
+      SDL_Rect axis = {0, rect.h / 2, rect.w, 2};
+      SDL_RenderFillRect(render, &axis);
+      for (int circle = 0; circle < 50; ++circle) {
+        Foundation::SDL_RenderDrawCircle(render, (circle * 17) % rect.w,
+                                         (circle * 29) % rect.h,
+                                         5 + circle % 5);
+      }
+    }
+    return iterations;
+  }));
+
+  SDL_DestroyRenderer(render);
+  SDL_FreeSurface(surface);
+  std::filesystem::remove_all(directory, error);
+
+  // 与基线比较：超出容差记为回归；基线中存在而本次缺失的项只提示。
+  int regressions = 0;
+  if (!gOptions.baselinePath.empty()) {
+    auto baseline = ReadBaseline(gOptions.baselinePath);
+    if (baseline.empty())
+      SDL_Log("benchmark: baseline %s is empty or unreadable",
+              gOptions.baselinePath.c_str());
+    for (auto &result : results) {
+      auto it = baseline.find(result.name);
+      if (it == baseline.end())
+        continue;
+      result.baseline = it->second;
+      result.regressed =
+          result.us > result.baseline * (1 + gOptions.benchmarkTolerance);
+      if (result.regressed) {
+        ++regressions;
+        SDL_Log("benchmark: %s regressed, %.3fus > %.3fus baseline",
+                result.name.c_str(), result.us, result.baseline);
+      }
+      baseline.erase(it);
+    }
+    for (const auto &missing : baseline)
+      SDL_Log("benchmark: %s missing from this run", missing.first.c_str());
+  }
+
+  if (!WriteResults(gOptions.benchmarkPath, results,
+                    gOptions.benchmarkTolerance)) {
+    SDL_Log("benchmark: write %s failed", gOptions.benchmarkPath.c_str());
+    return 1;
+  }
+  return regressions ? 2 : 0;
+}
+
+} // namespace Benchmark
+
+// 逐帧校验：FFPlayer.exe --verify [report] [--reference ref] [--input file]
+// 不创建窗口和音频设备，按解码速度解出视频与音频的全部帧，每帧输出一行
+// framemd5 格式的校验（stream#, dts, pts, duration, size, MD5）。哈希在调度器的
+// 工作线程上计算，解码线程只克隆帧引用；报告仍按解码顺序写出。
+namespace Verify {
+
+struct Stream {
+  int index = -1;  // 容器中的流序号
+  int output = -1; // 报告中的流序号，视频在前
+  AVCodecContext *context = nullptr;
+};
+
+AVCodecContext *OpenDecoder(const AVStream *stream) {
+  auto codec = avcodec_find_decoder(stream->codecpar->codec_id);
+  if (!codec)
+    return nullptr;
+  auto context = avcodec_alloc_context3(codec);
+  if (!context ||
+      avcodec_parameters_to_context(context, stream->codecpar) != 0) {
+    avcodec_free_context(&context);
+    return nullptr;
+  }
+  // 帧级多线程不影响输出，按核心数自动选择。
+  context->thread_count = 0;
+  context->pkt_timebase = stream->time_base;
+  if (avcodec_open2(context, codec, nullptr) != 0)
+    avcodec_free_context(&context);
+  return context;
+}
+
+// 音频转换器：每个工作线程缓存一个，输入格式、采样率或声道布局变化时重建。
+class SampleConverter {
+public:
+  SampleConverter() = default;
+  SampleConverter(const SampleConverter &) = delete;
+  SampleConverter &operator=(const SampleConverter &) = delete;
+  ~SampleConverter() {
+    swr_free(&context);
+    av_channel_layout_uninit(&layout);
+  }
+
+  // 转换为同采样率的交织 s16，返回输出字节数，失败返回负数。
+  int Convert(const AVFrame *frame, std::vector<uint8_t> &output) {
+    if (!Configure(frame))
+      return -1;
+    auto channels = frame->ch_layout.nb_channels;
+    output.resize(static_cast<std::size_t>(frame->nb_samples) * channels * 2);
+    auto out = output.data();
+    auto samples =
+        swr_convert(context, &out, frame->nb_samples,
+                    const_cast<const uint8_t **>(frame->extended_data),
+                    frame->nb_samples);
+    return samples < 0 ? samples : samples * channels * 2;
+  }
+
+private:
+  bool Configure(const AVFrame *frame) {
+    if (context && frame->format == format &&
+        frame->sample_rate == sampleRate &&
+        av_channel_layout_compare(&frame->ch_layout, &layout) == 0)
+      return true;
+
+    swr_free(&context);
+    av_channel_layout_uninit(&layout);
+    if (swr_alloc_set_opts2(&context, &frame->ch_layout, AV_SAMPLE_FMT_S16,
+                            frame->sample_rate, &frame->ch_layout,
+                            static_cast<AVSampleFormat>(frame->format),
+                            frame->sample_rate, 0, nullptr) < 0 ||
+        swr_init(context) < 0 ||
+        av_channel_layout_copy(&layout, &frame->ch_layout) < 0) {
+      swr_free(&context);
+      return false;
+    }
+    format = frame->format;
+    sampleRate = frame->sample_rate;
+    return true;
+  }
+
+  SwrContext *context = nullptr;
+  int format = -1;
+  int sampleRate = 0;
+  AVChannelLayout layout = {};
+};
+
+// 哈希解码器输出的原始数据，与 framemd5 默认的 rawvideo/pcm_s16le 输出一致：
+// 视频逐行哈希各平面的有效字节（即 1 字节对齐紧排的结果，调色板格式附带
+// 调色板），音频先转换为交织 s16。时间戳沿用容器流的时间基，与 ffmpeg 命令行
+// 按编码器时间基输出的 framemd5 不同，只有哈希与大小列可以直接对照。
+std::string HashFrame(int output, AVMediaType type, AVFrame *frame) {
+  auto md5 = av_md5_alloc();
+  av_md5_init(md5);
+  int size = 0;
+  if (type == AVMEDIA_TYPE_VIDEO) {
+    auto format = static_cast<AVPixelFormat>(frame->format);
+    auto descriptor = av_pix_fmt_desc_get(format);
+    int widths[4] = {0};
+    if (descriptor &&
+        av_image_fill_linesizes(widths, format, frame->width) >= 0) {
+      auto planes = av_pix_fmt_count_planes(format);
+      for (int plane = 0; plane < planes; ++plane) {
+        auto shift = plane == 1 || plane == 2 ? descriptor->log2_chroma_h : 0;
+        auto rows = (frame->height + (1 << shift) - 1) >> shift;
+        for (int row = 0; row < rows; ++row) {
+          av_md5_update(md5, frame->data[plane] + row * frame->linesize[plane],
+                        widths[plane]);
+        }
+        size += widths[plane] * rows;
+      }
+      if (descriptor->flags & AV_PIX_FMT_FLAG_PAL) {
+        av_md5_update(md5, frame->data[1], AVPALETTE_SIZE);
+        size += AVPALETTE_SIZE;
+      }
+    }
+  } else {
+    thread_local SampleConverter converter;
+    thread_local std::vector<uint8_t> samples;
+    size = (std::max)(converter.Convert(frame, samples), 0);
+    av_md5_update(md5, samples.data(), size);
+  }
+
+  uint8_t digest[16];
+  av_md5_final(md5, digest);
+  av_free(md5);
+
+  char hash[33] = {0};
+  for (int i = 0; i < 16; ++i)
+    std::snprintf(hash + i * 2, 3, "%02x", digest[i]);
+  char line[160] = {0};
+  std::snprintf(line, sizeof(line), "%d, %10lld, %10lld, %8lld, %8d, %s\n",
+                output, static_cast<long long>(frame->pkt_dts),
+                static_cast<long long>(frame->best_effort_timestamp),
+                static_cast<long long>(frame->duration), size, hash);
+  av_frame_free(&frame);
+  return line;
+}
+
+void WriteHeader(std::FILE *file, AVFormatContext *formatContext,
+                 const std::vector<Stream> &streams) {
+  std::fprintf(file, "#format: frame checksums\n#version: 2\n#hash: MD5\n");
+  for (const auto &stream : streams) {
+    auto timeBase = formatContext->streams[stream.index]->time_base;
+    auto context = stream.context;
+    std::fprintf(file, "#tb %d: %d/%d\n", stream.output, timeBase.num,
+                 timeBase.den);
+    std::fprintf(file, "#media_type %d: %s\n", stream.output,
+                 av_get_media_type_string(context->codec_type));
+    std::fprintf(file, "#codec_id %d: %s\n", stream.output,
+                 avcodec_get_name(context->codec_id));
+    if (context->codec_type == AVMEDIA_TYPE_VIDEO) {
+      std::fprintf(file, "#dimensions %d: %dx%d\n", stream.output,
+                   context->width, context->height);
+    } else {
+      char layout[64] = {0};
+      av_channel_layout_describe(&context->ch_layout, layout, sizeof(layout));
+      std::fprintf(file, "#sample_rate %d: %d\n", stream.output,
+                   context->sample_rate);
+      std::fprintf(file, "#channel_layout_name %d: %s\n", stream.output,
+                   layout);
+    }
+  }
+  std::fprintf(file, "#stream#, dts,        pts, duration,     size, hash\n");
+}
+
+std::vector<std::string> ReadLines(const std::string &path) {
+  std::vector<std::string> lines;
+  std::FILE *file = nullptr;
+  fopen_s(&file, path.c_str(), "rb");
+  if (!file)
+    return lines;
+
+  std::string line;
+  char buffer[4096];
+  std::size_t read = 0;
+  while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    for (std::size_t i = 0; i < read; ++i) {
+      if (buffer[i] == '\n') {
+        lines.push_back(std::move(line));
+        line.clear();
+      } else if (buffer[i] != '\r') {
+        line.push_back(buffer[i]);
+      }
+    }
+  }
+  if (!line.empty())
+    lines.push_back(std::move(line));
+  std::fclose(file);
+  return lines;
+}
+
+// 逐行比较，# 开头的是流参数。返回不一致的行数，只打印前若干处。
+std::size_t Compare(const std::vector<std::string> &report,
+                    const std::vector<std::string> &reference) {
+  constexpr std::size_t maxPrinted = 10;
+  std::size_t mismatches = 0;
+  auto lines = (std::max)(report.size(), reference.size());
+  for (std::size_t i = 0; i < lines; ++i) {
+    auto actual = i < report.size() ? report[i] : std::string("(missing)");
+    auto expected =
+        i < reference.size() ? reference[i] : std::string("(missing)");
+    if (actual == expected)
+      continue;
+    if (++mismatches <= maxPrinted) {
+      SDL_Log("verify: line %zu differs\n  expected %s\n  actual   %s", i + 1,
+              expected.c_str(), actual.c_str());
+    }
+  }
+  return mismatches;
+}
+
+int Run() {
+  std::string url = gOptions.input == "-" ? "pipe:0" : gOptions.input;
+  if (url.empty()) {
+    std::filesystem::path path(wil::GetModuleFileNameW<std::wstring>(nullptr));
+    path = path.parent_path().append("demo.mp4");
+    url = SysWideToMultiByte(path.c_str(), CP_ACP);
+  }
+
+  AVFormatContext *formatContext = nullptr;
+  if (avformat_open_input(&formatContext, url.c_str(), nullptr, nullptr) != 0 ||
+      avformat_find_stream_info(formatContext, nullptr) < 0) {
+    SDL_Log("verify: open %s failed", url.c_str());
+    avformat_close_input(&formatContext);
+    return 1;
+  }
+
+  // 与播放一致，校验最佳视频流和音频流；其余流不读。
+  std::vector<Stream> streams;
+  for (auto type : {AVMEDIA_TYPE_VIDEO, AVMEDIA_TYPE_AUDIO}) {
+    auto index = av_find_best_stream(formatContext, type, -1, -1, nullptr, 0);
+    if (index < 0)
+      continue;
+    Stream stream;
+    stream.index = index;
+    stream.output = static_cast<int>(streams.size());
+    stream.context = OpenDecoder(formatContext->streams[index]);
+    if (!stream.context) {
+      SDL_Log("verify: stream %d has no decoder", index);
+      continue;
+    }
+    streams.push_back(stream);
+  }
+  for (unsigned int i = 0; i < formatContext->nb_streams; ++i)
+    formatContext->streams[i]->discard = AVDISCARD_ALL;
+  for (const auto &stream : streams)
+    formatContext->streams[stream.index]->discard = AVDISCARD_DEFAULT;
+
+  std::FILE *file = nullptr;
+  fopen_s(&file, gOptions.verifyPath.c_str(), "wb");
+  if (!file || streams.empty()) {
+    SDL_Log("verify: nothing to write to %s", gOptions.verifyPath.c_str());
+    if (file)
+      std::fclose(file);
+    for (auto &stream : streams)
+      avcodec_free_context(&stream.context);
+    avformat_close_input(&formatContext);
+    return 1;
+  }
+  WriteHeader(file, formatContext, streams);
+
+  // 排队中的哈希按解码顺序写出；未完成的数量受限，内存不随文件长度增长。
+  auto &scheduler = *Foundation::gScheduler;
+  auto maxPending = scheduler.size() * 4;
+  std::deque<std::future<std::string>> pending;
+  std::size_t frames = 0;
+  auto flush = [&](std::size_t keep) {
+    while (pending.size() > keep) {
+      std::fputs(pending.front().get().c_str(), file);
+      pending.pop_front();
+    }
+  };
+
+  auto begin = SDL_GetPerformanceCounter();
+  auto frame = av_frame_alloc();
+  auto receive = [&](const Stream &stream) {
+    auto type = stream.context->codec_type;
+    while (avcodec_receive_frame(stream.context, frame) == 0) {
+      auto copy = av_frame_clone(frame);
+      av_frame_unref(frame);
+      if (!copy)
+        continue;
+      ++frames;
+      pending.push_back(scheduler.Submit(
+          Foundation::Scheduler::Decode,
+          [output = stream.output, type, copy]() {
+            return HashFrame(output, type, copy);
+          }));
+      flush(maxPending);
+    }
+  };
+
+  auto packet = stream::gPacketPool.acquire();
+  while (packet && av_read_frame(formatContext, packet) == 0) {
+    for (const auto &stream : streams) {
+      if (stream.index == packet->stream_index) {
+        avcodec_send_packet(stream.context, packet);
+        receive(stream);
+      }
+    }
+    av_packet_unref(packet);
+  }
+  stream::gPacketPool.release(packet);
+  for (const auto &stream : streams) {
+    avcodec_send_packet(stream.context, nullptr);
+    receive(stream);
+  }
+  flush(0);
+  std::fclose(file);
+
+  auto seconds = (SDL_GetPerformanceCounter() - begin) * 1.0 /
+                 SDL_GetPerformanceFrequency();
+  SDL_Log("verify: %zu frames in %.2fs (%.1f fps), report %s", frames, seconds,
+          seconds > 0 ? frames / seconds : 0.0, gOptions.verifyPath.c_str());
+
+  av_frame_free(&frame);
+  for (auto &stream : streams)
+    avcodec_free_context(&stream.context);
+  avformat_close_input(&formatContext);
+
+  if (gOptions.referencePath.empty())
+    return 0;
+  auto reference = ReadLines(gOptions.referencePath);
+  if (reference.empty()) {
+    SDL_Log("verify: reference %s is empty or unreadable",
+            gOptions.referencePath.c_str());
+    return 1;
+  }
+  auto mismatches = Compare(ReadLines(gOptions.verifyPath), reference);
+  if (mismatches) {
+    SDL_Log("verify: %zu lines differ from %s", mismatches,
+            gOptions.referencePath.c_str());
+    return 2;
+  }
+  SDL_Log("verify: bit-exact with %s", gOptions.referencePath.c_str());
+  return 0;
+}
+
+} // namespace Verify
+
+// 共享内存帧的参考读者：FFPlayer.exe --consume <name>
+// 等待播放器以 --export <name> 发布帧，每秒输出一次吞吐量与丢帧数，播放器退出
+// 或 5 秒内没有新帧时结束。
+int RunFrameConsumer() {
+  stream::FrameReader reader(gOptions.consumeName);
+  for (int retry = 0; !reader.Open(); ++retry) {
+    if (retry >= 100) {
+      SDL_Log("consumer %s: no producer", gOptions.consumeName.c_str());
+      return 1;
+    }
+    SDL_Delay(100);
+  }
+
+  stream::FrameReader::Frame frame;
+  auto frequency = SDL_GetPerformanceFrequency();
+  auto reportCounter = SDL_GetPerformanceCounter();
+  auto lastFrameCounter = reportCounter;
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+  while (true) {
+    auto now = SDL_GetPerformanceCounter();
+    if (reader.Next(frame, 500)) {
+      ++frames;
+      bytes += frame.data.size();
+      lastFrameCounter = now;
+    } else if (now - lastFrameCounter > frequency * 5) {
+      break;
+    }
+
+    if (now - reportCounter >= frequency) {
+      auto seconds = (now - reportCounter) * 1.0 / frequency;
+      SDL_Log("consumer: %.1f fps, %.1f MB/s, frame %lld %dx%d, %llu dropped",
+              frames / seconds, bytes / seconds / (1024 * 1024),
+              static_cast<long long>(frame.frameIndex), frame.width,
+              frame.height, static_cast<unsigned long long>(reader.dropped()));
+      frames = 0;
+      bytes = 0;
+      reportCounter = now;
+    }
+  }
+
+  SDL_Log("consumer: %llu received, %llu dropped",
+          static_cast<unsigned long long>(reader.received()),
+          static_cast<unsigned long long>(reader.dropped()));
+  return 0;
 }
 
 int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
@@ -961,14 +5587,61 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
                       _In_ int nCmdShow) {
   UNREFERENCED_PARAMETER(hPrevInstance);
   UNREFERENCED_PARAMETER(lpCmdLine);
+  Foundation::gStartupCounter = SDL_GetPerformanceCounter();
+
+  gOptions = ParseCommandLine(GetCommandLineW());
+  if (!gOptions.tracePath.empty()) {
+    Foundation::Trace::gEnabled = true;
+    Foundation::Trace::SetThreadName("main");
+  }
+  if (!gOptions.consumeName.empty()) {
+    if (0 != SDL_Init(0)) {
+      return 1;
+    }
+    auto result = RunFrameConsumer();
+    SDL_Quit();
+    return result;
+  }
+
+  // 主线程负责渲染与事件，其余核心交给调度器。退出前销毁，已排队的任务会先
+  // 执行完。
+  Foundation::gScheduler = std::make_unique<Foundation::Scheduler>(
+      (std::max)(std::thread::hardware_concurrency(), 3u) - 1);
+
+  // 基准测试不创建窗口，软件渲染器直接绘制到内存表面。
+  if (!gOptions.benchmarkPath.empty()) {
+    auto result = 1;
+    if (0 == SDL_Init(0)) {
+      result = Benchmark::Run();
+      SDL_Quit();
+    }
+    Foundation::gScheduler.reset();
+    return result;
+  }
+
+  // 校验同样无界面，只用到 SDL 的计时与日志。
+  if (!gOptions.verifyPath.empty()) {
+    auto result = 1;
+    if (0 == SDL_Init(0)) {
+      result = Verify::Run();
+      SDL_Quit();
+    }
+    Foundation::gScheduler.reset();
+    return result;
+  }
 
-  if (0 != SDL_Init(SDL_INIT_EVERYTHING)) {
+  // 只初始化窗口和事件子系统，音频在预热阶段按需初始化。
+  if (0 != SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS)) {
+    Foundation::gScheduler.reset();
     return 1;
   }
   auto config = avcodec_configuration();
+  avformat_network_init();
 
   RunSimpleFFPlayerDemo();
+  Foundation::gScheduler.reset();
 
+  avformat_network_deinit();
   SDL_Quit();
   return 0;
 }
\ No newline at end of file